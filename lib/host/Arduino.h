@@ -0,0 +1,204 @@
+#pragma once
+// Just enough of the ESP8266 Arduino core to build src/ on the host. Time is
+// simulated: millis()/micros() only move through delay() and hostAdvance(),
+// so tests see exactly how long the bridge code kept the CPU busy.
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int uint;
+
+#define D1 5
+#define D2 4
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+
+#define HEX 16
+#define DEC 10
+
+using std::max;
+using std::min;
+#define constrain(amt, low, high) \
+    ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long howbig);
+long random(long howsmall, long howbig);
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+#if defined(__GLIBC__) && \
+    !(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 38))
+size_t strlcpy(char* dst, const char* src, size_t size);
+#endif
+
+class String {
+   public:
+    String(const char* value = "");
+    String(const String& other);
+    ~String();
+    String& operator=(const String& other);
+    String& operator=(const char* value);
+    bool concat(const char* value);
+    bool concat(const String& value) { return concat(value.c_str()); }
+    String& operator+=(const char* value) {
+        concat(value);
+        return *this;
+    }
+    const char* c_str() const { return buffer ? buffer : ""; }
+    unsigned int length() const { return len; }
+    bool operator==(const char* value) const {
+        return strcmp(c_str(), value ? value : "") == 0;
+    }
+
+   private:
+    char* buffer = nullptr;
+    unsigned int len = 0;
+};
+
+class StringSumHelper : public String {
+   public:
+    StringSumHelper(const String& value) : String(value) {}
+    StringSumHelper(const char* value) : String(value) {}
+};
+
+StringSumHelper operator+(const StringSumHelper& lhs, const String& rhs);
+StringSumHelper operator+(const StringSumHelper& lhs, const char* rhs);
+
+class Print {
+   public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* text) {
+        return text ? write((const uint8_t*)text, strlen(text)) : 0;
+    }
+    size_t write(const char* buffer, size_t size) {
+        return write((const uint8_t*)buffer, size);
+    }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+    size_t print(const char* text) { return write(text); }
+    size_t print(const String& text) { return write(text.c_str()); }
+    size_t print(char value) { return write((uint8_t)value); }
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) {
+        size_t n = print(value);
+        return n + println();
+    }
+    size_t printf(const char* format, ...);
+};
+
+class Stream : public Print {
+   public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() { return -1; }
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() const { return _timeout; }
+    size_t readBytes(char* buffer, size_t length);
+    size_t readBytes(uint8_t* buffer, size_t length) {
+        return readBytes((char*)buffer, length);
+    }
+
+   protected:
+    unsigned long _timeout = 1000;
+};
+
+// A serial port on the host. Received bytes are fed in by the test; written
+// bytes land in a capture buffer, and every write() call is logged with its
+// start time. A blocking port holds the CPU for the whole frame like
+// SoftwareSerial's bit-banging does; a non-blocking one drains in the
+// background like the UART FIFO.
+#define HOST_SERIAL_RX 2048
+#define HOST_SERIAL_TX 16384
+#define HOST_SERIAL_WRITES 64
+
+class HostSerialPort : public Stream {
+   public:
+    struct Write {
+        unsigned long startUs;
+        size_t offset;
+        size_t length;
+    };
+
+    explicit HostSerialPort(bool blocking) : blocking(blocking) {}
+    void begin(unsigned long baud) { this->baud = baud; }
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    int availableForWrite() override { return 128; }
+    operator bool() const { return true; }
+
+    // Test side
+    void hostInput(const uint8_t* data, size_t length);
+    void hostInput(const char* text) {
+        hostInput((const uint8_t*)text, strlen(text));
+    }
+    // Everything written since the last hostClear(), zero terminated
+    const char* hostOutput() const { return (const char*)tx; }
+    const uint8_t* hostBytes() const { return tx; }
+    size_t hostLength() const { return txLength; }
+    uint16_t hostWrites() const { return writeCount; }
+    const Write& hostWrite(uint16_t index) const {
+        return writes[index % HOST_SERIAL_WRITES];
+    }
+    void hostClear();
+    unsigned long hostBusyUntilUs() const { return busyUntilUs; }
+
+   private:
+    bool blocking;
+    unsigned long baud = 9600;
+    uint8_t rx[HOST_SERIAL_RX];
+    size_t rxHead = 0;
+    size_t rxCount = 0;
+    uint8_t tx[HOST_SERIAL_TX + 1];
+    size_t txLength = 0;
+    Write writes[HOST_SERIAL_WRITES];
+    uint16_t writeCount = 0;
+    unsigned long busyUntilUs = 0;
+};
+
+class HardwareSerial : public HostSerialPort {
+   public:
+    HardwareSerial() : HostSerialPort(false) {}
+    void swap() { swapped = true; }
+    void setDebugOutput(bool) {}
+    bool swapped = false;
+};
+
+extern HardwareSerial Serial;
+
+struct EspClass {
+    void restart();
+    void reset() { restart(); }
+    void eraseConfig() {}
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getMaxFreeBlockSize() { return 30000; }
+    uint8_t getHeapFragmentation() { return 0; }
+};
+
+extern EspClass ESP;
+
+#include <host.h>
@@ -0,0 +1,40 @@
+#pragma once
+#include <Arduino.h>
+
+typedef enum { WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL = 1, WL_CONNECTED = 3,
+               WL_CONNECT_FAILED = 4, WL_DISCONNECTED = 6 } wl_status_t;
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+
+class WiFiClient : public Stream {
+   public:
+    // The ESP8266 core uses the Stream timeout as the TCP connect timeout
+    WiFiClient() { _timeout = 5000; }
+    size_t write(uint8_t value) override { return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { return size; }
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    // Free space in the TCP send buffer
+    int availableForWrite() override { return hostWriteSpace; }
+    int hostWriteSpace = 2920;
+};
+
+class ESP8266WiFiClass {
+   public:
+    bool mode(WiFiMode_t mode) { return true; }
+    // Starts connecting with the saved credentials, returns right away
+    wl_status_t begin() {
+        hostBeginCalls++;
+        return status();
+    }
+    wl_status_t status() { return hostStatus; }
+    String macAddress() { return String("5C:CF:7F:00:00:01"); }
+    String SSID() { return String(hostSavedSsid ? "show" : ""); }
+    void setAutoReconnect(bool) {}
+
+    wl_status_t hostStatus = WL_DISCONNECTED;
+    bool hostSavedSsid = true;
+    int hostBeginCalls = 0;
+};
+
+extern ESP8266WiFiClass WiFi;
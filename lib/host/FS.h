@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+
+#define HOST_FS_FILES 16
+#define HOST_FS_PATH 48
+#define HOST_FS_SIZE 8192
+
+// In-memory flash file system with fixed slots
+struct HostFile {
+    bool used;
+    char path[HOST_FS_PATH];
+    uint8_t data[HOST_FS_SIZE];
+    size_t size;
+};
+
+class File : public Stream {
+   public:
+    File() {}
+    File(HostFile* file, bool writable) : file(file), writable(writable) {}
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t* buffer, size_t size);
+    size_t size() const { return file ? file->size : 0; }
+    size_t position() const { return pos; }
+    void close() { file = nullptr; }
+    operator bool() const { return file != nullptr; }
+    const char* name() const { return file ? file->path : ""; }
+
+   private:
+    HostFile* file = nullptr;
+    bool writable = false;
+    size_t pos = 0;
+};
+
+class FS {
+   public:
+    bool begin() { return true; }
+    bool format();
+    bool exists(const char* path);
+    File open(const char* path, const char* mode);
+    bool remove(const char* path);
+    bool rename(const char* from, const char* to);
+    bool mkdir(const char* path) { return true; }
+
+    // Writes fail as on a full or worn out flash
+    bool hostFailWrites = false;
+
+   private:
+    HostFile* find(const char* path);
+    HostFile files[HOST_FS_FILES];
+};
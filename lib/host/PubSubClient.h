@@ -0,0 +1,79 @@
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define HOST_MQTT_PUBLISHES 32
+#define HOST_MQTT_TOPIC 96
+#define HOST_MQTT_PAYLOAD 4096
+#define HOST_MQTT_SUBSCRIPTIONS 8
+
+// Records what the bridge publishes instead of sending it. A broker that is
+// down costs the full TCP connect timeout per connect(), like on the device.
+class PubSubClient : public Print {
+   public:
+    typedef std::function<void(char*, uint8_t*, unsigned int)> Callback;
+    struct Message {
+        char topic[HOST_MQTT_TOPIC];
+        uint8_t payload[HOST_MQTT_PAYLOAD + 1];
+        unsigned int length;
+    };
+
+    explicit PubSubClient(WiFiClient& client) : tcp(client) {}
+    PubSubClient& setServer(const char* domain, uint16_t port) { return *this; }
+    PubSubClient& setCallback(Callback callback) {
+        this->callback = callback;
+        return *this;
+    }
+    bool setBufferSize(uint16_t size) {
+        bufferSize = size;
+        return true;
+    }
+    PubSubClient& setSocketTimeout(uint16_t seconds) {
+        socketTimeout = seconds;
+        return *this;
+    }
+    bool connect(const char* id);
+    bool connected() { return isConnected; }
+    bool loop() { return isConnected; }
+    bool subscribe(const char* topic);
+    bool publish(const char* topic, const char* payload) {
+        return publish(topic, (const uint8_t*)payload, strlen(payload));
+    }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length);
+    bool beginPublish(const char* topic, unsigned int length, bool retained);
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int endPublish();
+
+    // Test side
+    bool hostBrokerReachable = true;
+    uint16_t bufferSize = 256;
+    uint16_t socketTimeout = 15;
+    int hostConnectAttempts = 0;
+    // Calls the callback like a message from the broker would
+    void hostDeliver(const char* topic, const uint8_t* payload,
+                     unsigned int length);
+    void hostDeliver(const char* topic, const char* payload) {
+        hostDeliver(topic, (const uint8_t*)payload, strlen(payload));
+    }
+    const Message* hostLast(const char* topicSuffix) const;
+    uint32_t hostPublishes() const { return published; }
+    // Whether a subscription so far covers topic, with + and # like a broker
+    bool hostSubscribed(const char* topic) const;
+    void hostDisconnect() { isConnected = false; }
+
+   private:
+    Message& next();
+
+    WiFiClient& tcp;
+    Callback callback;
+    bool isConnected = false;
+    Message messages[HOST_MQTT_PUBLISHES];
+    uint32_t published = 0;
+    Message* streaming = nullptr;
+    char subscriptions[HOST_MQTT_SUBSCRIPTIONS][HOST_MQTT_TOPIC];
+    uint8_t subscriptionCount = 0;
+    char deliverTopic[HOST_MQTT_TOPIC];
+    uint8_t deliverPayload[HOST_MQTT_PAYLOAD];
+};
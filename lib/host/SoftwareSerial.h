@@ -0,0 +1,8 @@
+#pragma once
+#include <Arduino.h>
+
+// Bit-banged on the device: write() keeps the CPU for the whole frame
+class SoftwareSerial : public HostSerialPort {
+   public:
+    SoftwareSerial(int8_t rxPin, int8_t txPin) : HostSerialPort(true) {}
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define WEBSOCKETS_SERVER_CLIENT_MAX 5
+#define HOST_WEBSOCKET_MESSAGES 32
+#define HOST_WEBSOCKET_MESSAGE 1024
+
+typedef enum {
+    WStype_ERROR,
+    WStype_DISCONNECTED,
+    WStype_CONNECTED,
+    WStype_TEXT,
+    WStype_BIN,
+} WStype_t;
+
+struct WSclient_t {
+    uint8_t num;
+    WiFiClient* tcp;
+};
+
+// Like links2004/WebSockets on the ESP8266, sendTXT() writes synchronously:
+// with a full TCP send buffer it sits in the write loop until the TCP
+// timeout. The test side plays the clients.
+class WebSocketsServer {
+   public:
+    typedef std::function<void(uint8_t num, WStype_t type, uint8_t* payload,
+                               size_t length)>
+        WebSocketServerEvent;
+    struct Message {
+        uint8_t num;
+        bool binary;
+        char data[HOST_WEBSOCKET_MESSAGE + 1];
+        size_t length;
+    };
+
+    explicit WebSocketsServer(uint16_t port);
+    void begin() { started = true; }
+    void loop() {}
+    void onEvent(WebSocketServerEvent event) { this->event = event; }
+    bool sendTXT(uint8_t num, const char* payload, size_t length = 0);
+    bool sendBIN(uint8_t num, const uint8_t* payload, size_t length);
+
+    // Test side
+    bool started = false;
+    void hostConnect(uint8_t num);
+    void hostDisconnect(uint8_t num);
+    void hostText(uint8_t num, const char* text);
+    void hostBinary(uint8_t num, const uint8_t* data, size_t length);
+    const Message* hostLast(uint8_t num) const;
+    uint32_t hostSent() const { return sent; }
+    WiFiClient hostTcp[WEBSOCKETS_SERVER_CLIENT_MAX];
+
+   protected:
+    WSclient_t _clients[WEBSOCKETS_SERVER_CLIENT_MAX];
+
+   private:
+    bool send(uint8_t num, bool binary, const uint8_t* payload, size_t length);
+
+    WebSocketServerEvent event;
+    Message messages[HOST_WEBSOCKET_MESSAGES];
+    uint32_t sent = 0;
+    uint8_t buffer[HOST_WEBSOCKET_MESSAGE + 1];
+};
+
+// The server src/websocket.cpp created, for the tests to talk to
+extern WebSocketsServer* hostWebSocketServer;
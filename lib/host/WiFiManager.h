@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+class WiFiManagerParameter {
+   public:
+    WiFiManagerParameter(const char* id, const char* label,
+                         const char* defaultValue, int length);
+    void setValue(const char* value, int length);
+    const char* getValue() const { return value; }
+
+   private:
+    char value[64];
+};
+
+// autoConnect() first waits for the saved network like the real one does, up
+// to the connect timeout (60 s when none is set) when it is not there.
+class WiFiManager {
+   public:
+    void setDebugOutput(bool) {}
+    void setConfigPortalBlocking(bool blocking) { portalBlocking = blocking; }
+    void setSaveConfigCallback(std::function<void()>) {}
+    void setConnectTimeout(unsigned long seconds) { connectTimeout = seconds; }
+    bool addParameter(WiFiManagerParameter*) { return true; }
+    bool getWiFiIsSaved() { return WiFi.hostSavedSsid; }
+    bool autoConnect(const char* ssid, const char* password);
+    bool startConfigPortal(const char* ssid, const char* password);
+    bool process() { return WiFi.status() == WL_CONNECTED; }
+    bool stopConfigPortal() {
+        hostPortalActive = false;
+        return true;
+    }
+    void resetSettings() {}
+
+    bool hostPortalActive = false;
+    int hostAutoConnectCalls = 0;
+
+   private:
+    bool portalBlocking = true;
+    unsigned long connectTimeout = 0;
+};
@@ -0,0 +1,503 @@
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <PubSubClient.h>
+#include <WebSocketsServer.h>
+#include <WiFiManager.h>
+#include <stdarg.h>
+
+#include <new>
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+ArduinoOTAClass ArduinoOTA;
+FS LittleFS;
+WebSocketsServer* hostWebSocketServer = nullptr;
+bool hostRestarted = false;
+
+/*Clock*/
+static unsigned long nowUs = 0;
+
+unsigned long millis() { return nowUs / 1000; }
+unsigned long micros() { return nowUs; }
+void delay(unsigned long ms) { nowUs += ms * 1000; }
+void yield() {}
+void hostAdvance(unsigned long us) { nowUs += us; }
+void hostAdvanceMs(unsigned long ms) { nowUs += ms * 1000; }
+void hostSetTime(unsigned long us) { nowUs = us; }
+
+long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+long random(long howsmall, long howbig) {
+    return howsmall + random(howbig - howsmall);
+}
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+#if defined(__GLIBC__) && \
+    !(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 38))
+size_t strlcpy(char* dst, const char* src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, copied);
+        dst[copied] = '\0';
+    }
+    return length;
+}
+#endif
+
+void EspClass::restart() { hostRestarted = true; }
+
+// Through malloc(), so the allocation accounting sees new as well
+void* operator new(size_t size) {
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+/*String*/
+String::String(const char* value) { *this = value; }
+String::String(const String& other) { *this = other.c_str(); }
+String::~String() { free(buffer); }
+String& String::operator=(const String& other) {
+    if (this != &other) {
+        *this = other.c_str();
+    }
+    return *this;
+}
+String& String::operator=(const char* value) {
+    len = 0;
+    if (buffer) {
+        buffer[0] = '\0';
+    }
+    concat(value);
+    return *this;
+}
+bool String::concat(const char* value) {
+    if (!value) {
+        return false;
+    }
+    size_t added = strlen(value);
+    char* grown = (char*)realloc(buffer, len + added + 1);
+    if (!grown) {
+        return false;
+    }
+    buffer = grown;
+    memcpy(buffer + len, value, added + 1);
+    len += added;
+    return true;
+}
+StringSumHelper operator+(const StringSumHelper& lhs, const String& rhs) {
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+StringSumHelper operator+(const StringSumHelper& lhs, const char* rhs) {
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+
+/*Print and Stream*/
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (size--) {
+        written += write(*buffer++);
+    }
+    return written;
+}
+static size_t printNumber(Print& out, long long value, bool isSigned,
+                          int base) {
+    char text[24];
+    if (base == HEX) {
+        snprintf(text, sizeof(text), "%llX", (unsigned long long)value);
+    } else if (isSigned) {
+        snprintf(text, sizeof(text), "%lld", value);
+    } else {
+        snprintf(text, sizeof(text), "%llu", (unsigned long long)value);
+    }
+    return out.write(text);
+}
+size_t Print::print(int value, int base) {
+    return printNumber(*this, value, true, base);
+}
+size_t Print::print(unsigned int value, int base) {
+    return printNumber(*this, value, false, base);
+}
+size_t Print::print(long value, int base) {
+    return printNumber(*this, value, true, base);
+}
+size_t Print::print(unsigned long value, int base) {
+    return printNumber(*this, value, false, base);
+}
+size_t Print::printf(const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) {
+        return 0;
+    }
+    return write((const uint8_t*)text, min((size_t)length, sizeof(text) - 1));
+}
+size_t Stream::readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int value = read();
+        if (value < 0) {
+            break;
+        }
+        buffer[count++] = (char)value;
+    }
+    return count;
+}
+
+/*Serial ports*/
+size_t HostSerialPort::write(const uint8_t* buffer, size_t size) {
+    const unsigned long byteUs = (10000000UL + baud / 2) / baud;
+    Write& entry = writes[writeCount++ % HOST_SERIAL_WRITES];
+    entry.startUs = micros();
+    entry.offset = txLength;
+    entry.length = size;
+    size_t copied = min(size, (size_t)HOST_SERIAL_TX - txLength);
+    memcpy(tx + txLength, buffer, copied);
+    txLength += copied;
+    tx[txLength] = 0;
+
+    if (blocking) {
+        hostAdvance(size * byteUs);
+        return size;
+    }
+    // UART: the 128 byte FIFO drains in the background, write() only waits
+    // when it is full
+    const unsigned long now = micros();
+    if (busyUntilUs < now) {
+        busyUntilUs = now;
+    }
+    busyUntilUs += size * byteUs;
+    const unsigned long fifoUs = 128 * byteUs;
+    if (busyUntilUs - now > fifoUs) {
+        hostAdvance(busyUntilUs - now - fifoUs);
+    }
+    return size;
+}
+int HostSerialPort::available() { return rxCount; }
+int HostSerialPort::read() {
+    if (rxCount == 0) {
+        return -1;
+    }
+    uint8_t value = rx[rxHead];
+    rxHead = (rxHead + 1) % HOST_SERIAL_RX;
+    rxCount--;
+    return value;
+}
+int HostSerialPort::peek() { return rxCount ? rx[rxHead] : -1; }
+void HostSerialPort::hostInput(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length && rxCount < HOST_SERIAL_RX; i++) {
+        rx[(rxHead + rxCount++) % HOST_SERIAL_RX] = data[i];
+    }
+}
+void HostSerialPort::hostClear() {
+    txLength = 0;
+    tx[0] = 0;
+    writeCount = 0;
+}
+
+/*MQTT*/
+bool PubSubClient::connect(const char* id) {
+    hostConnectAttempts++;
+    if (!hostBrokerReachable || WiFi.status() != WL_CONNECTED) {
+        // The TCP connect sits out its timeout
+        delay(tcp.getTimeout());
+        isConnected = false;
+        return false;
+    }
+    isConnected = true;
+    return true;
+}
+bool PubSubClient::subscribe(const char* topic) {
+    if (!isConnected) {
+        return false;
+    }
+    if (subscriptionCount < HOST_MQTT_SUBSCRIPTIONS) {
+        strlcpy(subscriptions[subscriptionCount++], topic, HOST_MQTT_TOPIC);
+    }
+    return true;
+}
+static bool topicMatches(const char* filter, const char* topic) {
+    while (*filter) {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (*topic && *topic != '/') {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*filter != *topic) {
+            return false;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == 0;
+}
+bool PubSubClient::hostSubscribed(const char* topic) const {
+    for (uint8_t i = 0; i < subscriptionCount; i++) {
+        if (topicMatches(subscriptions[i], topic)) {
+            return true;
+        }
+    }
+    return false;
+}
+PubSubClient::Message& PubSubClient::next() {
+    return messages[published++ % HOST_MQTT_PUBLISHES];
+}
+bool PubSubClient::publish(const char* topic, const uint8_t* payload,
+                           unsigned int length) {
+    if (!isConnected) {
+        return false;
+    }
+    // lwIP allocates a pbuf for every packet on the device
+    void* volatile pbuf = malloc(length + 64);
+    free(pbuf);
+    Message& message = next();
+    strlcpy(message.topic, topic, sizeof(message.topic));
+    message.length = min(length, (unsigned int)HOST_MQTT_PAYLOAD);
+    memcpy(message.payload, payload, message.length);
+    message.payload[message.length] = 0;
+    return true;
+}
+bool PubSubClient::beginPublish(const char* topic, unsigned int length,
+                                bool retained) {
+    if (!isConnected) {
+        return false;
+    }
+    streaming = &next();
+    strlcpy(streaming->topic, topic, sizeof(streaming->topic));
+    streaming->length = 0;
+    return true;
+}
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+    if (!streaming) {
+        return 0;
+    }
+    size_t copied = min(size, (size_t)HOST_MQTT_PAYLOAD - streaming->length);
+    memcpy(streaming->payload + streaming->length, buffer, copied);
+    streaming->length += copied;
+    return size;
+}
+int PubSubClient::endPublish() {
+    streaming = nullptr;
+    return 1;
+}
+void PubSubClient::hostDeliver(const char* topic, const uint8_t* payload,
+                               unsigned int length) {
+    strlcpy(deliverTopic, topic, sizeof(deliverTopic));
+    length = min(length, (unsigned int)HOST_MQTT_PAYLOAD);
+    memcpy(deliverPayload, payload, length);
+    callback(deliverTopic, deliverPayload, length);
+}
+const PubSubClient::Message* PubSubClient::hostLast(
+    const char* topicSuffix) const {
+    const size_t suffixLength = strlen(topicSuffix);
+    const uint32_t kept = min(published, (uint32_t)HOST_MQTT_PUBLISHES);
+    for (uint32_t i = 1; i <= kept; i++) {
+        const Message& message = messages[(published - i) % HOST_MQTT_PUBLISHES];
+        const size_t length = strlen(message.topic);
+        if (length >= suffixLength &&
+            strcmp(message.topic + length - suffixLength, topicSuffix) == 0) {
+            return &message;
+        }
+    }
+    return nullptr;
+}
+
+/*WiFiManager*/
+WiFiManagerParameter::WiFiManagerParameter(const char* id, const char* label,
+                                           const char* defaultValue,
+                                           int length) {
+    strlcpy(value, defaultValue, sizeof(value));
+}
+void WiFiManagerParameter::setValue(const char* newValue, int length) {
+    strlcpy(value, newValue, sizeof(value));
+}
+bool WiFiManager::autoConnect(const char* ssid, const char* password) {
+    hostAutoConnectCalls++;
+    if (getWiFiIsSaved() && WiFi.status() != WL_CONNECTED) {
+        // connectWifi() -> WiFi.waitForConnectResult()
+        delay(connectTimeout ? connectTimeout * 1000 : 60000);
+    }
+    if (WiFi.status() == WL_CONNECTED) {
+        return true;
+    }
+    return startConfigPortal(ssid, password);
+}
+bool WiFiManager::startConfigPortal(const char* ssid, const char* password) {
+    hostPortalActive = true;
+    return false;
+}
+
+/*LittleFS*/
+HostFile* FS::find(const char* path) {
+    for (HostFile& file : files) {
+        if (file.used && strcmp(file.path, path) == 0) {
+            return &file;
+        }
+    }
+    return nullptr;
+}
+bool FS::format() {
+    for (HostFile& file : files) {
+        file.used = false;
+    }
+    return true;
+}
+bool FS::exists(const char* path) { return find(path) != nullptr; }
+File FS::open(const char* path, const char* mode) {
+    HostFile* file = find(path);
+    if (mode[0] == 'r') {
+        return file ? File(file, mode[1] == '+') : File();
+    }
+    if (!file) {
+        for (HostFile& slot : files) {
+            if (!slot.used) {
+                file = &slot;
+                break;
+            }
+        }
+        if (!file) {
+            return File();
+        }
+        file->used = true;
+        strlcpy(file->path, path, sizeof(file->path));
+        file->size = 0;
+    }
+    if (mode[0] == 'w') {
+        file->size = 0;
+    }
+    return File(file, true);
+}
+bool FS::remove(const char* path) {
+    HostFile* file = find(path);
+    if (!file) {
+        return false;
+    }
+    file->used = false;
+    return true;
+}
+bool FS::rename(const char* from, const char* to) {
+    HostFile* file = find(from);
+    if (!file) {
+        return false;
+    }
+    // Like lfs_rename(), an existing file at to is replaced in one go
+    HostFile* existing = find(to);
+    if (existing && existing != file) {
+        existing->used = false;
+    }
+    strlcpy(file->path, to, sizeof(file->path));
+    return true;
+}
+size_t File::write(const uint8_t* buffer, size_t size) {
+    if (!file || !writable || LittleFS.hostFailWrites) {
+        return 0;
+    }
+    size_t written = min(size, (size_t)HOST_FS_SIZE - pos);
+    memcpy(file->data + pos, buffer, written);
+    pos += written;
+    if (pos > file->size) {
+        file->size = pos;
+    }
+    return written;
+}
+int File::available() { return file ? file->size - pos : 0; }
+int File::read() { return available() > 0 ? file->data[pos++] : -1; }
+int File::peek() { return available() > 0 ? file->data[pos] : -1; }
+size_t File::read(uint8_t* buffer, size_t size) {
+    size_t count = min(size, (size_t)available());
+    if (count) {
+        memcpy(buffer, file->data + pos, count);
+        pos += count;
+    }
+    return count;
+}
+
+/*WebSocket*/
+WebSocketsServer::WebSocketsServer(uint16_t port) {
+    for (uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        _clients[i].num = i;
+        _clients[i].tcp = &hostTcp[i];
+    }
+    hostWebSocketServer = this;
+}
+bool WebSocketsServer::send(uint8_t num, bool binary, const uint8_t* payload,
+                            size_t length) {
+    if (num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+        return false;
+    }
+    // Frame header included. With no room the library keeps retrying the
+    // write until WEBSOCKETS_TCP_TIMEOUT runs out.
+    if ((size_t)hostTcp[num].availableForWrite() < length + 4) {
+        delay(5000);
+        return false;
+    }
+    Message& message = messages[sent++ % HOST_WEBSOCKET_MESSAGES];
+    message.num = num;
+    message.binary = binary;
+    message.length = min(length, (size_t)HOST_WEBSOCKET_MESSAGE);
+    memcpy(message.data, payload, message.length);
+    message.data[message.length] = 0;
+    return true;
+}
+bool WebSocketsServer::sendTXT(uint8_t num, const char* payload,
+                               size_t length) {
+    return send(num, false, (const uint8_t*)payload,
+                length ? length : strlen(payload));
+}
+bool WebSocketsServer::sendBIN(uint8_t num, const uint8_t* payload,
+                               size_t length) {
+    return send(num, true, payload, length);
+}
+void WebSocketsServer::hostConnect(uint8_t num) {
+    event(num, WStype_CONNECTED, nullptr, 0);
+}
+void WebSocketsServer::hostDisconnect(uint8_t num) {
+    event(num, WStype_DISCONNECTED, nullptr, 0);
+}
+void WebSocketsServer::hostText(uint8_t num, const char* text) {
+    size_t length = min(strlen(text), (size_t)HOST_WEBSOCKET_MESSAGE);
+    memcpy(buffer, text, length);
+    buffer[length] = 0;
+    event(num, WStype_TEXT, buffer, length);
+}
+void WebSocketsServer::hostBinary(uint8_t num, const uint8_t* data,
+                                  size_t length) {
+    length = min(length, (size_t)HOST_WEBSOCKET_MESSAGE);
+    memcpy(buffer, data, length);
+    event(num, WStype_BIN, buffer, length);
+}
+const WebSocketsServer::Message* WebSocketsServer::hostLast(
+    uint8_t num) const {
+    const uint32_t kept = min(sent, (uint32_t)HOST_WEBSOCKET_MESSAGES);
+    for (uint32_t i = 1; i <= kept; i++) {
+        const Message& message = messages[(sent - i) % HOST_WEBSOCKET_MESSAGES];
+        if (message.num == num) {
+            return &message;
+        }
+    }
+    return nullptr;
+}
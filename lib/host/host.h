@@ -0,0 +1,14 @@
+#pragma once
+// Test-side controls of the host stand-ins. Nothing in src/ includes this.
+#include <stdint.h>
+
+// Simulated clock, starts at 0
+void hostAdvance(unsigned long us);
+void hostAdvanceMs(unsigned long ms);
+void hostSetTime(unsigned long us);
+
+// Set by ESP.restart()
+extern bool hostRestarted;
+
+// One byte (start, 8 data, stop bit) on a 9600 baud line
+#define HOST_BAUD_BYTE_US 1042
@@ -0,0 +1,40 @@
+#pragma once
+// Test-side helpers around src/: the simulated VISCA chains and the flight
+// recorder. Header only, it needs the src/ headers the suites build with.
+#include <Arduino.h>
+#include <bus.h>
+#include <trace.h>
+
+// The simulated daisy chain behind a bus
+inline HostSerialPort& hostChain(uint8_t bus = 0) {
+    return *static_cast<HostSerialPort*>(buses[bus].port);
+}
+
+struct HostTraceCapture : Print {
+    uint8_t data[16 + TRACE_RECORDS * sizeof(TraceRecord)];
+    size_t length = 0;
+    size_t write(uint8_t value) override {
+        if (length < sizeof(data)) {
+            data[length++] = value;
+        }
+        return 1;
+    }
+};
+
+// The newest flight recorder record of a TraceKind, read back through
+// traceDump(). False if the ring holds none.
+inline bool hostLastTrace(uint8_t kind, TraceRecord& record) {
+    static HostTraceCapture capture;
+    capture.length = 0;
+    traceDump(capture);
+    uint16_t count;
+    memcpy(&count, capture.data + 6, sizeof(count));
+    for (uint16_t i = count; i > 0; i--) {
+        memcpy(&record, capture.data + 16 + (i - 1) * sizeof(TraceRecord),
+               sizeof(TraceRecord));
+        if (record.kind == kind) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,133 @@
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include <bus.h>
+#include <metrics.h>
+#include <recovery.h>
+#include <trace.h>
+
+static_assert(VISCA_BUSES >= 1 && VISCA_BUSES <= 3, "1 to 3 VISCA buses");
+static_assert(VISCA_CAMS_PER_BUS >= 1 && VISCA_CAMS_PER_BUS <= 7,
+              "a VISCA chain has 1 to 7 addresses");
+
+static SoftwareSerial viscaPort0(D1, D2);
+#if VISCA_BUSES > 1
+static SoftwareSerial viscaPort1(D5, D6);
+#endif
+
+ViscaBus buses[VISCA_BUSES];
+
+uint8_t cameraBus(uint8_t cam) { return cam / VISCA_CAMS_PER_BUS; }
+uint8_t cameraAddress(uint8_t cam) { return cam % VISCA_CAMS_PER_BUS + 1; }
+
+void beginBuses() {
+    viscaPort0.begin(9600);
+    buses[0].port = &viscaPort0;
+#if VISCA_BUSES > 1
+    viscaPort1.begin(9600);
+    buses[1].port = &viscaPort1;
+#endif
+#if VISCA_BUSES > 2
+    Serial.begin(9600);
+    Serial.swap();
+    buses[2].port = &Serial;
+#endif
+}
+
+/*TX*/
+bool busEnqueue(uint8_t cam, const VISCACommand& command, TopicId topicId,
+                bool bypass) {
+    if (cam >= NUM_CAMS) {
+        traceRecord(TRACE_TX, cam, topicId, TRACE_DROPPED, command.payload,
+                    command.len);
+        return false;
+    }
+    ViscaBus& bus = buses[cameraBus(cam)];
+    if (!bypass && !cameraAvailable(cam)) {
+        metrics.recoveryDrops++;
+        traceRecord(TRACE_TX, cam, topicId, TRACE_DROPPED, command.payload,
+                    command.len);
+        return false;
+    }
+    if (bus.queueCount >= VISCA_BUS_QUEUE) {
+        metrics.busQueueFull++;
+        traceRecord(TRACE_TX, cam, topicId, TRACE_DROPPED, command.payload,
+                    command.len);
+        return false;
+    }
+    uint8_t slot = (bus.queueHead + bus.queueCount) % VISCA_BUS_QUEUE;
+    bus.queue[slot].cam = cam;
+    bus.queue[slot].topicId = topicId;
+    bus.queue[slot].bypass = bypass;
+    bus.queue[slot].command = command;
+    bus.queueCount++;
+    return true;
+}
+
+void busWrite(uint8_t cam, const VISCACommand& command, TopicId topicId,
+              bool bypass) {
+    if (cam >= NUM_CAMS) {
+        traceRecord(TRACE_TX, cam, topicId, TRACE_DROPPED, command.payload,
+                    command.len);
+        return;
+    }
+    if (!bypass && !cameraAvailable(cam)) {
+        // Quarantined while it was queued or scheduled
+        metrics.recoveryDrops++;
+        traceRecord(TRACE_TX, cam, topicId, TRACE_DROPPED, command.payload,
+                    command.len);
+        return;
+    }
+    buses[cameraBus(cam)].port->write(command.payload, command.len);
+    recoveryOnSend(cam, command, topicId);
+    metrics.busFramesSent++;
+    traceRecord(TRACE_TX, cam, topicId, TRACE_OK, command.payload, command.len);
+}
+
+void busWriteRaw(uint8_t bus, const uint8_t* data, size_t length) {
+    buses[bus < VISCA_BUSES ? bus : 0].port->write(data, length);
+}
+
+/*RX*/
+static void receive(uint8_t busIndex, ViscaBus& bus) {
+    while (bus.port->available() > 0) {
+        uint8_t receivedByte = bus.port->read();
+        // Replies start with 0x90 + (address << 4) and end with 0xff, every
+        // byte in between is below 0x80.
+        bool isHeader = (receivedByte & 0x8F) == 0x80 && receivedByte >= 0x90;
+        if (isHeader) {
+            // Also resyncs when a terminator got lost
+            bus.receiving = true;
+            bus.replyLength = 0;
+        }
+        if (!bus.receiving) {
+            continue;
+        }
+        bus.reply[bus.replyLength++] = receivedByte;
+        if (receivedByte == 0xff) {
+            uint8_t address = (bus.reply[0] >> 4) - 8;
+            uint8_t cam = busIndex * VISCA_CAMS_PER_BUS + address - 1;
+            // Addresses past the chain length would be another bus's cameras
+            if (address <= VISCA_CAMS_PER_BUS && cam < NUM_CAMS) {
+                parseCommand(cam, bus.reply, bus.replyLength);
+            }
+            bus.receiving = false;
+        } else if (bus.replyLength >= VISCA_REPLY_MAX_LENGTH) {
+            // Longer than any reply, drop it
+            bus.receiving = false;
+        }
+    }
+}
+
+void serviceBuses() {
+    for (uint8_t i = 0; i < VISCA_BUSES; i++) {
+        ViscaBus& bus = buses[i];
+        receive(i, bus);
+        if (bus.queueCount > 0) {
+            auto& entry = bus.queue[bus.queueHead];
+            busWrite(entry.cam, entry.command, (TopicId)entry.topicId,
+                     entry.bypass);
+            bus.queueHead = (bus.queueHead + 1) % VISCA_BUS_QUEUE;
+            bus.queueCount--;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#include <Arduino.h>
+#pragma once
+#include <camera.h>
+#include <commands.h>
+#include <topics.h>
+
+// Every bus is its own daisy chain with addresses 1..VISCA_CAMS_PER_BUS.
+// Global camera IDs are handed out in bus order, so with 2 buses of 4 cameras
+// cam 5 is address 2 on bus 1.
+//   bus 0: SoftwareSerial RX D1, TX D2
+//   bus 1: SoftwareSerial RX D5, TX D6
+//   bus 2: hardware UART swapped to RX D7, TX D8 (no USB serial then)
+// VISCA_BUSES and VISCA_CAMS_PER_BUS are set in camera.h, NUM_CAMS follows
+// from them.
+#define VISCA_BUS_QUEUE 6
+#define VISCA_REPLY_MAX_LENGTH 17
+
+struct ViscaBus {
+    Stream* port;
+    // TX queue, drained one frame per bus and loop() pass
+    struct {
+        uint8_t cam;
+        uint8_t topicId;
+        bool bypass;
+        VISCACommand command;
+    } queue[VISCA_BUS_QUEUE];
+    uint8_t queueHead;
+    uint8_t queueCount;
+    // RX parser
+    bool receiving;
+    uint8_t reply[VISCA_REPLY_MAX_LENGTH];
+    uint8_t replyLength;
+};
+
+extern ViscaBus buses[VISCA_BUSES];
+
+// Only for cam < NUM_CAMS, busEnqueue() and busWrite() drop anything else
+uint8_t cameraBus(uint8_t cam);
+uint8_t cameraAddress(uint8_t cam);
+
+void beginBuses();
+// bypass sends to a quarantined camera as well, for the recovery's own frames
+bool busEnqueue(uint8_t cam, const VISCACommand& command,
+                TopicId topicId = TOPIC_UNKNOWN, bool bypass = false);
+void busWrite(uint8_t cam, const VISCACommand& command,
+              TopicId topicId = TOPIC_UNKNOWN, bool bypass = false);
+void busWriteRaw(uint8_t bus, const uint8_t* data, size_t length);
+void serviceBuses();
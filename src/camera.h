@@ -6,7 +6,14 @@
 #define MAXZ 2885
 //Range 4096-4672
 #define MAXF 5000
-#define NUM_CAMS 7
+// Bus layout, see bus.h. Every address on every bus is a camera.
+#ifndef VISCA_BUSES
+#define VISCA_BUSES 1
+#endif
+#ifndef VISCA_CAMS_PER_BUS
+#define VISCA_CAMS_PER_BUS 7
+#endif
+#define NUM_CAMS (VISCA_BUSES * VISCA_CAMS_PER_BUS)
 
 
 class PTZCam {
@@ -21,23 +28,29 @@ class PTZCam {
     int getY() const { return y; }
     int getZ() const { return z; }
     int getFocus() const { return focus; }
+    // Bumped on every change, lets state pushes skip cameras nobody touched
+    uint16_t getVersion() const { return version; }
 
     // Setter methods
     void setX(int newX) {
         newX = constrain(newX, 0, MAXX);
         x = newX;
+        version++;
     }
     void setY(int newY) {
         newY = constrain(newY, 0, MAXY);
         y = newY;
+        version++;
     }
     void setZ(int newZ) {
         newZ = constrain(newZ, 0, MAXZ);
         z = newZ;
+        version++;
     }
     void setFocus(int newFocus) {
         newFocus = constrain(newFocus, -1, MAXF);
         focus = newFocus;
+        version++;
     }
 
    private:
@@ -45,6 +58,7 @@ class PTZCam {
     int y;
     int z;
     int focus;
+    uint16_t version = 0;
 };
 
 extern PTZCam cams[NUM_CAMS];
\ No newline at end of file
@@ -1,22 +1,34 @@
 #include <Arduino.h>
+#include <bus.h>
 #include <camera.h>
 #include <commands.h>
 #include <ArduinoJson.h>
 #include <FS.h>
+#include <velocity.h>
 
 PTZCam cams[NUM_CAMS];
 
 /*VISCA Commands*/
 VISCACommand makePackage(byte* payload, uint8_t length, uint8_t camNum) {
     VISCACommand cmd;
-    uint8_t charCount = 0;
-    cmd.payload[charCount++] = 0x81 + camNum;
+    cmd.len = 0;
+    appendPackage(cmd, payload, length, camNum);
+    return cmd;
+}
+// Adds one more complete frame (header, payload, terminator) to cmd. Used for
+// sequences like "set mode, then set value" that go out back to back.
+void appendPackage(VISCACommand& cmd, byte* payload, uint8_t length,
+                   uint8_t camNum) {
+    if (cmd.len + length + 2 > VISCACOMMAND_MAX_LENGTH) {
+        return;
+    }
+    uint8_t charCount = cmd.len;
+    cmd.payload[charCount++] = 0x80 + cameraAddress(camNum);
     for (uint8_t i = 0; i < length; i++) {
         cmd.payload[charCount++] = payload[i];
     }
     cmd.payload[charCount++] = 0xFF;
     cmd.len = charCount;
-    return cmd;
 }
 VISCACommand blinkenlights(uint8_t led, uint8_t mode, uint8_t cam) {
     byte cmd[] = {0x01, 0x33, led, mode};
@@ -35,7 +47,8 @@ VISCACommand mirror(bool setting, uint8_t cam) {
     return command;
 }
 VISCACommand backlight(bool setting, uint8_t cam) {
-    byte cmd[] = {0x01, 0x04, 0x33, 0x02, (setting ? 0x02 : 0x03)};
+    // 8x 01 04 33 02 ff on, 8x 01 04 33 03 ff off
+    byte cmd[] = {0x01, 0x04, 0x33, (setting ? 0x02 : 0x03)};
     VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
     return command;
 }
@@ -51,27 +64,36 @@ void convertValues(uint input, byte* output) {
     output[3] = input & 0x0f;
 }
 VISCACommand wb(int setting, uint8_t cam) {
+    // -1 is auto, 8x 01 04 35 00 ff. Anything else switches to manual and
+    // sets the value, 8x 01 04 35 06 ff then 8x 01 04 75 0p 0q 0r 0s ff.
+    byte automatic[] = {0x01, 0x04, 0x35, 0x00};
+    if (setting <= -1) {
+        return makePackage(automatic, sizeof(automatic), cam);
+    }
     byte wbValues[4];
     convertValues(setting, wbValues);
-    byte cmd[] = {
-        0x01,       0x04,        0x35,        (setting <= -1 ? 0x00 : 0x06),
-        0xff,       0x81 + cam,  0x01,        0x04,
-        0x75,       wbValues[0], wbValues[1], wbValues[2],
-        wbValues[3]};
-    VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
+    byte mode[] = {0x01, 0x04, 0x35, 0x06};
+    byte value[] = {0x01,        0x04,        0x75,       wbValues[0],
+                    wbValues[1], wbValues[2], wbValues[3]};
+    VISCACommand command = makePackage(mode, sizeof(mode), cam);
+    appendPackage(command, value, sizeof(value), cam);
     return command;
 }
 VISCACommand iris(int setting, uint8_t cam) {
+    // -1 is full auto exposure, 8x 01 04 39 00 ff. Anything else switches to
+    // manual and sets the iris, 8x 01 04 39 03 ff then 8x 01 04 4b 00 00 0p
+    // 0q ff.
+    byte automatic[] = {0x01, 0x04, 0x39, 0x00};
+    if (setting <= -1) {
+        return makePackage(automatic, sizeof(automatic), cam);
+    }
     byte irisValues[4];
-    convertValues(setting, irisValues);
-    byte cmd[] = {0x01,          0x04,
-                  0x39,          (setting <= -1 ? 0x00 : 0x03),
-                  0xff,          0x81 + cam,
-                  0x01,          0x04,
-                  0x4b,          irisValues[0],
-                  irisValues[1], irisValues[2],
-                  irisValues[3]};
-    VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
+    convertValues(setting & 0xff, irisValues);
+    byte mode[] = {0x01, 0x04, 0x39, 0x03};
+    byte value[] = {0x01,          0x04,          0x4b,         irisValues[0],
+                    irisValues[1], irisValues[2], irisValues[3]};
+    VISCACommand command = makePackage(mode, sizeof(mode), cam);
+    appendPackage(command, value, sizeof(value), cam);
     return command;
 }
 
@@ -98,16 +120,35 @@ VISCACommand relativeMovement(int x, int y, uint8_t cam) {
     byte panSpeed = map(abs(x), 0, 100, 0x00, 0x1f);
     byte tiltSpeed = map(abs(y), 0, 100, 0x00, 0x1f);
 
-    byte cmd[] = {0x01, 0x06, 0x01, 0x00, 0x00, 0x03, 0x03, 0xff, 0x81+cam, 0x01,      0x06,         0x01,         panSpeed,
+    byte stop[] = {0x01, 0x06, 0x01, 0x00, 0x00, 0x03, 0x03};
+    byte move[] = {0x01,      0x06,         0x01,         panSpeed,
+                   tiltSpeed, panDirection, tiltDirection};
+    VISCACommand command = makePackage(stop, sizeof(stop), cam);
+    appendPackage(command, move, sizeof(move), cam);
+    return command;
+}
+VISCACommand panTiltDrive(byte panSpeed, byte tiltSpeed, int x, int y,
+                          uint8_t cam) {
+    // Single drive frame without the leading stop, for continuous updates
+    byte panDirection = x > 0 ? 0x02 : (x < 0 ? 0x01 : 0x03);
+    byte tiltDirection = y > 0 ? 0x02 : (y < 0 ? 0x01 : 0x03);
+    if (panSpeed == 0) {
+        panDirection = 0x03;
+    }
+    if (tiltSpeed == 0) {
+        tiltDirection = 0x03;
+    }
+    byte cmd[] = {0x01,      0x06,         0x01,         panSpeed,
                   tiltSpeed, panDirection, tiltDirection};
     VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
     return command;
 }
-VISCACommand movement(uint8_t cam) {
-    const uint x = cams[cam].getX();
-    const uint y = cams[cam].getY();
-    const uint z = cams[cam].getZ();
-    const uint focus = cams[cam].getFocus();
+VISCACommand movement(uint8_t cam) { return movement(cam, cams[cam]); }
+VISCACommand movement(uint8_t cam, const PTZCam& target) {
+    const uint x = target.getX();
+    const uint y = target.getY();
+    const uint z = target.getZ();
+    const uint focus = target.getFocus();
 
     byte xValues[4];
     convertValues(x, xValues);
@@ -120,49 +161,62 @@ VISCACommand movement(uint8_t cam) {
 
     byte focusValues[4];
     convertValues(focus, focusValues);
-    byte cmd[] = {0x01,           0x04,
-                  0x38,           (focus == -1 ? 0x02 : 0x03),
-                  0xff,           (0x81 + cam),
-                  0x01,           0x06,
-                  0x01,           0x03,
-                  0x03,           0x03,
-                  0x03,           0xff,
-                  (0x81 + cam),   0x01,
-                  0x06,           0x20,
-                  xValues[0],     xValues[1],
-                  xValues[2],     xValues[3],
-
-                  yValues[0],     yValues[1],
-                  yValues[2],     yValues[3],
-                  zValues[0],     zValues[1],
-                  zValues[2],     zValues[3],
-                  focusValues[0], focusValues[1],
-                  focusValues[2], focusValues[3]};
-    VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
+    byte focusMode[] = {0x01, 0x04, 0x38, (byte)(focus == -1 ? 0x02 : 0x03)};
+    byte stop[] = {0x01, 0x06, 0x01, 0x03, 0x03, 0x03, 0x03};
+    byte position[] = {0x01,           0x06,           0x20,
+                       xValues[0],     xValues[1],     xValues[2],
+                       xValues[3],     yValues[0],     yValues[1],
+                       yValues[2],     yValues[3],     zValues[0],
+                       zValues[1],     zValues[2],     zValues[3],
+                       focusValues[0], focusValues[1], focusValues[2],
+                       focusValues[3]};
+    VISCACommand command = makePackage(focusMode, sizeof(focusMode), cam);
+    appendPackage(command, stop, sizeof(stop), cam);
+    appendPackage(command, position, sizeof(position), cam);
 
     return command;
 }
 
 VISCACommand clearBuffer(uint8_t cam) {
-
-    byte cmd[] = {(0x81 + cam),           0x01,
-                  0x00,                   0x01,
-                  0xff
-                  };
+    // 8x 01 00 01 ff, IF_Clear
+    byte cmd[] = {0x01, 0x00, 0x01};
     VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
 
     return command;
 }
 
 VISCACommand setAddress(uint8_t cam, int address) {
-    byte cmd[] = {(0x81 + cam),           0x30,
-                  (0x00 + address),           0xff
-                  };
-    VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
+    // 88 30 0p ff, AddressSet is a broadcast. The first camera on the chain
+    // takes address p, every following one counts up from there.
+    VISCACommand command;
+    command.payload[0] = 0x88;
+    command.payload[1] = 0x30;
+    command.payload[2] = address & 0x0f;
+    command.payload[3] = 0xFF;
+    command.len = 4;
 
     return command;
 }
 
+VISCACommand stateInquiry(uint8_t cam) {
+    // 8x 09 06 12 ff pan/tilt, 8x 09 04 47 ff zoom, 8x 09 04 48 ff focus
+    byte panTilt[] = {0x09, 0x06, 0x12};
+    byte zoom[] = {0x09, 0x04, 0x47};
+    byte focus[] = {0x09, 0x04, 0x48};
+    VISCACommand command = makePackage(panTilt, sizeof(panTilt), cam);
+    appendPackage(command, zoom, sizeof(zoom), cam);
+    appendPackage(command, focus, sizeof(focus), cam);
+
+    return command;
+}
+
+VISCACommand powerInquiry(uint8_t cam) {
+    // 8x 09 04 00 ff, answered with y0 50 0p ff
+    byte cmd[] = {0x09, 0x04, 0x00};
+    VISCACommand command = makePackage(cmd, sizeof(cmd), cam);
+
+    return command;
+}
 
 void requestEverything() {
     // 8x 09 06 12 ff request PT
@@ -175,6 +229,94 @@ void requestEverything() {
     }
 }
 
+/*JSON to VISCA*/
+bool cameraInRange(JsonObject args) {
+    // Not as<uint8_t>(), that turns 300 into 0, a real camera
+    const long cam = args["cam"] | 0L;
+    return cam >= 0 && cam < NUM_CAMS;
+}
+bool encodeCameraCommand(TopicId topicId, JsonObject args, CommandSink& sink) {
+    const uint8_t cam = args["cam"].as<uint8_t>();
+
+    if (topicId == TOPIC_CAMERA_BLINKENLIGHTS) {
+        sink.frame(cam, blinkenlights(args["led"].as<uint8_t>(),
+                                      args["mode"].as<uint8_t>(), cam));
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_SETTINGS) {
+        if (args.containsKey("backlight")) {
+            sink.frame(cam, backlight(args["backlight"].as<bool>(), cam));
+        }
+        if (args.containsKey("mirror")) {
+            sink.frame(cam, mirror(args["mirror"].as<bool>(), cam));
+        }
+        if (args.containsKey("flip")) {
+            sink.frame(cam, flip(args["flip"].as<bool>(), cam));
+        }
+        if (args.containsKey("mmdetect")) {
+            sink.frame(cam, mmdetect(args["mmdetect"].as<bool>(), cam));
+        }
+        //  ir_output, ir_cameracontrol
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_PICTURE) {
+        if (args.containsKey("wb")) {
+            sink.frame(cam, wb(args["wb"].as<int>(), cam));
+        }
+        if (args.containsKey("iris")) {
+            sink.frame(cam, iris(args["iris"].as<int>(), cam));
+        }
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_MOVETO) {
+        PTZCam target = sink.state(cam);
+        if (args.containsKey("x")) {
+            target.setX(args["x"].as<int>());
+        }
+        if (args.containsKey("y")) {
+            target.setY(args["y"].as<int>());
+        }
+        if (args.containsKey("z")) {
+            target.setZ(args["z"].as<int>());
+        }
+        if (args.containsKey("focus")) {
+            target.setFocus(args["focus"].as<int>());
+        }
+        sink.shadow(cam, target);
+        sink.frame(cam, movement(cam, target));
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_MOVEBY) {
+        sink.frame(cam, relativeMovement(args["x"] | 0, args["y"] | 0, cam));
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_VELOCITY) {
+        int x = args["x"].as<int>();
+        int y = args["y"].as<int>();
+        int zoom = sink.state(cam).getZ();
+        sink.frame(cam, panTiltDrive(velocitySpeed(x, zoom),
+                                     velocitySpeed(y, zoom), x, y, cam));
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_CLEARBUFFER) {
+        sink.frame(cam, clearBuffer(cam));
+        return true;
+    }
+
+    if (topicId == TOPIC_CAMERA_SETADDRESS) {
+        sink.frame(cam, setAddress(cam, args["address"].as<int>()));
+        return true;
+    }
+
+    return false;
+}
+
 /*System Commands*/
 void handleCommands(char* topic, byte* payload, unsigned int length){
     /*DynamicJsonBuffer response(1024);
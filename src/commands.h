@@ -1,5 +1,8 @@
 #pragma once
+#include <ArduinoJson.h>
 #include <camera.h>
+#include <topics.h>
+#include <trace.h>
 #define VISCACOMMAND_MAX_LENGTH 128
 
 struct VISCACommand {
@@ -8,13 +11,23 @@ struct VISCACommand {
 };
 
 void convertValues(uint input, byte* output);
-void parseCommand(uint8_t* command, int length);
+void parseCommand(uint8_t cam, uint8_t* command, int length);
 void requestEverything();
-void handleSerial();
 
 void handleCommands(char* topic, byte* payload, unsigned int length);
+// Where a command came from. Its answers go back the same way.
+struct CommandOrigin {
+    uint8_t source;  // TraceKind: TRACE_MQTT, TRACE_WEBSOCKET or TRACE_CONSOLE
+    uint8_t client;  // WebSocket client number
+};
+// Returns TRACE_OK, or what kept the command from being carried out
+TraceOutcome dispatchCommand(TopicId topicId, byte* payload,
+                             unsigned int length, CommandOrigin origin);
+void reply(CommandOrigin origin, const char* subTopic, const char* message);
 
 VISCACommand makePackage(byte* payload, uint8_t length, uint8_t camNum);
+void appendPackage(VISCACommand& cmd, byte* payload, uint8_t length,
+                   uint8_t camNum);
 VISCACommand blinkenlights(uint8_t led = 0, uint8_t mode = 0, uint8_t cam = 0);
 VISCACommand flip(bool setting = 0, uint8_t cam = 0);
 VISCACommand mirror(bool setting = 0, uint8_t cam = 0);
@@ -23,7 +36,25 @@ VISCACommand mmdetect(bool setting = 0, uint8_t cam = 0);
 VISCACommand wb(int setting = 0, uint8_t cam = 0);
 VISCACommand iris(int setting = 0, uint8_t cam = 0);
 VISCACommand relativeMovement(int x, int y, uint8_t cam = 0);
+VISCACommand panTiltDrive(byte panSpeed, byte tiltSpeed, int x, int y,
+                          uint8_t cam = 0);
 VISCACommand clearBuffer(uint8_t cam = 0);
 VISCACommand setAddress(uint8_t cam = 0, int address = 0);
+VISCACommand stateInquiry(uint8_t cam = 0);
+VISCACommand powerInquiry(uint8_t cam = 0);
 
 VISCACommand movement(uint8_t cam = 0);
+VISCACommand movement(uint8_t cam, const PTZCam& target);
+
+// Where encodeCameraCommand() puts its results. The live path sends frames
+// and updates cams[], the macro compiler stores both as bytecode.
+struct CommandSink {
+    virtual void frame(uint8_t cam, const VISCACommand& command) = 0;
+    virtual void shadow(uint8_t cam, const PTZCam& target) {}
+    // Shadow state that partial moveto commands start from
+    virtual const PTZCam& state(uint8_t cam) { return cams[cam]; }
+};
+// args["cam"] has to pass cameraInRange() first
+bool encodeCameraCommand(TopicId topicId, JsonObject args, CommandSink& sink);
+// False when "cam" names no camera on the buses. No cam is camera 0.
+bool cameraInRange(JsonObject args);
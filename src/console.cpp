@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include <bus.h>
+#include <commands.h>
+#include <console.h>
+#include <topics.h>
+#include <trace.h>
+
+// With three buses the hardware UART is swapped over to the cameras
+#if VISCA_BUSES < 3
+
+static char line[CONSOLE_LINE_LENGTH];
+static size_t lineLength = 0;
+static bool overflow = false;
+
+static void handleLine() {
+    char* payload = strchr(line, ' ');
+    if (payload) {
+        *payload++ = '\0';
+    } else {
+        payload = line + lineLength;
+    }
+    TopicId topicId = classifyTopic(line);
+    if (topicId == TOPIC_UNKNOWN) {
+        Serial.println("error: unknown topic");
+        return;
+    }
+    switch (dispatchCommand(topicId, (byte*)payload, strlen(payload),
+                            {TRACE_CONSOLE, 0})) {
+        case TRACE_BAD_JSON:
+            Serial.println("error: bad json");
+            break;
+        case TRACE_DROPPED:
+            Serial.println("error: dropped");
+            break;
+        default:
+            Serial.println("ok");
+            break;
+    }
+}
+
+void beginConsole() { Serial.println("ready"); }
+
+void consoleReply(const char* subTopic, const char* message) {
+    Serial.print(subTopic);
+    Serial.print(' ');
+    Serial.println(message);
+}
+
+void serviceConsole() {
+    while (Serial.available() > 0) {
+        char received = Serial.read();
+        if (received == '\r') {
+            continue;
+        }
+        if (received != '\n') {
+            if (lineLength < CONSOLE_LINE_LENGTH - 1) {
+                line[lineLength++] = received;
+            } else {
+                overflow = true;
+            }
+            continue;
+        }
+        line[lineLength] = '\0';
+        if (overflow) {
+            Serial.println("error: line too long");
+        } else if (lineLength > 0) {
+            handleLine();
+        }
+        lineLength = 0;
+        overflow = false;
+    }
+}
+
+#else
+
+void beginConsole() {}
+void serviceConsole() {}
+void consoleReply(const char* subTopic, const char* message) {}
+
+#endif
@@ -0,0 +1,14 @@
+#include <Arduino.h>
+#pragma once
+
+// Control over the USB serial port, available as soon as setup() is through,
+// long before Wi-Fi or the broker. One command per line, same format as the
+// WebSocket text messages:
+//   command/camera/moveto {"x": 400, "cam": 1}
+// Every line is answered with "ok" or an error. Answers to the command itself
+// come as "<topic> <json>" lines, e.g. return/system/time {"time":118000}.
+#define CONSOLE_LINE_LENGTH 256
+
+void beginConsole();
+void serviceConsole();
+void consoleReply(const char* subTopic, const char* message);
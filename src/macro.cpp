@@ -0,0 +1,489 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <bus.h>
+#include <macro.h>
+#include <metrics.h>
+#include <recovery.h>
+
+#define MACRO_HEADER_SIZE 5
+
+struct MacroSlot {
+    char name[MACRO_NAME_LENGTH + 1];  // empty when the slot is free
+    uint16_t size;
+    uint32_t lastUsed;
+    uint8_t code[MACRO_MAX_SIZE];
+};
+
+struct MacroRun {
+    int8_t slot;  // -1 when idle
+    char name[MACRO_NAME_LENGTH + 1];
+    uint16_t pc;
+    uint8_t step;
+    uint8_t steps;
+    uint32_t waitUntil;
+    bool waiting;
+    bool gating;
+    uint8_t gateCam;
+    // Completions expected for the frames sent so far, and seen
+    uint16_t expected[NUM_CAMS];
+    uint16_t completed[NUM_CAMS];
+};
+
+static MacroSlot cache[MACRO_CACHE_SLOTS];
+static MacroRun run = {-1};
+// Static like commandDocument, a define costs no heap on the message path
+static StaticJsonDocument<MACRO_JSON_SIZE> defineDocument;
+static void (*macroCallback)(const char* message) = nullptr;
+
+void setMacroCallback(void (*callback)(const char* message)) {
+    macroCallback = callback;
+}
+
+// Names become file names, so only letters, digits, - and _
+static bool validName(const char* name) {
+    size_t length = strlen(name);
+    if (length == 0 || length > MACRO_NAME_LENGTH) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isalnum(name[i]) && name[i] != '-' && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report(const char* name, const char* state, uint8_t step,
+                   uint8_t steps, const char* error = nullptr) {
+    if (!macroCallback) {
+        return;
+    }
+    // Echoed back into JSON, so anything that is not a valid name is left out
+    if (!validName(name)) {
+        name = "";
+    }
+    char message[128];
+    if (error) {
+        snprintf(message, sizeof(message),
+                 "{\"name\":\"%s\",\"state\":\"%s\",\"error\":\"%s\"}", name,
+                 state, error);
+    } else {
+        snprintf(message, sizeof(message),
+                 "{\"name\":\"%s\",\"state\":\"%s\",\"step\":%u,\"steps\":%u}",
+                 name, state, step, steps);
+    }
+    macroCallback(message);
+}
+
+static void macroPath(const char* name, char* path, size_t size) {
+    snprintf(path, size, "/macros/%s.vmc", name);
+}
+
+/*Cache*/
+static MacroSlot* findSlot(const char* name) {
+    for (MacroSlot& slot : cache) {
+        if (slot.name[0] && strcmp(slot.name, name) == 0) {
+            slot.lastUsed = millis();
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+// Free or least recently used slot, never the one being run
+static MacroSlot* claimSlot() {
+    MacroSlot* oldest = nullptr;
+    for (uint8_t i = 0; i < MACRO_CACHE_SLOTS; i++) {
+        if (i == run.slot) {
+            continue;
+        }
+        if (!cache[i].name[0]) {
+            return &cache[i];
+        }
+        if (!oldest || (int32_t)(cache[i].lastUsed - oldest->lastUsed) < 0) {
+            oldest = &cache[i];
+        }
+    }
+    if (oldest) {
+        oldest->name[0] = 0;
+    }
+    return oldest;
+}
+
+static void forget(const char* name) {
+    for (MacroSlot& slot : cache) {
+        if (slot.name[0] && strcmp(slot.name, name) == 0) {
+            slot.name[0] = 0;
+        }
+    }
+}
+
+static bool validCode(const uint8_t* code, size_t size) {
+    return size > MACRO_HEADER_SIZE && code[0] == 'V' && code[1] == 'M' &&
+           code[2] == 'C' && code[3] == MACRO_VERSION;
+}
+
+static MacroSlot* loadSlot(const char* name) {
+    MacroSlot* slot = findSlot(name);
+    if (slot) {
+        return slot;
+    }
+    char path[48];
+    macroPath(name, path, sizeof(path));
+    if (!LittleFS.exists(path)) {
+        return nullptr;
+    }
+    slot = claimSlot();
+    if (!slot) {
+        return nullptr;
+    }
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+        return nullptr;
+    }
+    size_t size = file.size();
+    if (size > MACRO_MAX_SIZE || file.read(slot->code, size) != size ||
+        !validCode(slot->code, size)) {
+        file.close();
+        return nullptr;
+    }
+    file.close();
+    metrics.macroLoads++;
+    strlcpy(slot->name, name, sizeof(slot->name));
+    slot->size = size;
+    slot->lastUsed = millis();
+    return slot;
+}
+
+/*Compiler*/
+// Encodes through the same encodeCameraCommand() as live commands, so a
+// macro step takes exactly the JSON the matching topic does.
+struct MacroCompiler : CommandSink {
+    uint8_t* out;
+    size_t used;
+    bool overflow;
+    TopicId topicId;
+    // moveto steps build on earlier ones in the same macro
+    PTZCam shadowState[NUM_CAMS];
+
+    // With out == nullptr it only checks and measures
+    MacroCompiler(uint8_t* out) : out(out), used(0), overflow(false) {
+        for (uint8_t i = 0; i < NUM_CAMS; i++) {
+            shadowState[i] = cams[i];
+        }
+    }
+    void put(uint8_t value) {
+        if (used < MACRO_MAX_SIZE) {
+            if (out) {
+                out[used] = value;
+            }
+            used++;
+        } else {
+            overflow = true;
+        }
+    }
+    void put16(uint16_t value) {
+        put(value & 0xFF);
+        put(value >> 8);
+    }
+    void frame(uint8_t cam, const VISCACommand& command) override {
+        put(OP_FRAME);
+        put(cam);
+        put(topicId);
+        put(command.len);
+        for (uint8_t i = 0; i < command.len; i++) {
+            put(command.payload[i]);
+        }
+    }
+    void shadow(uint8_t cam, const PTZCam& target) override {
+        shadowState[cam] = target;
+        put(OP_SHADOW);
+        put(cam);
+        put16(target.getX());
+        put16(target.getY());
+        put16(target.getZ());
+        put16(target.getFocus());
+    }
+    const PTZCam& state(uint8_t cam) override { return shadowState[cam]; }
+};
+
+static const char* compileMacro(JsonArray steps, MacroCompiler& compiler) {
+    if (steps.size() == 0 || steps.size() > 255) {
+        return "needs 1 to 255 steps";
+    }
+    compiler.put('V');
+    compiler.put('M');
+    compiler.put('C');
+    compiler.put(MACRO_VERSION);
+    compiler.put(steps.size());
+
+    for (JsonVariant step : steps) {
+        JsonObject args = step.as<JsonObject>();
+        compiler.put(OP_STEP);
+        if (args.containsKey("wait")) {
+            compiler.put(OP_WAIT);
+            compiler.put16(constrain(args["wait"].as<long>(), 0L, 65535L));
+        } else if (args.containsKey("gate")) {
+            const long gate = args["gate"] | 0L;
+            if (gate < 0 || gate >= NUM_CAMS) {
+                return "no such camera";
+            }
+            compiler.put(OP_GATE);
+            compiler.put(args["gate"].as<uint8_t>());
+            compiler.put16(constrain(args["timeout"] | (long)MACRO_GATE_TIMEOUT_MS,
+                                     0L, 65535L));
+        } else {
+            compiler.topicId = classifyTopic(args["topic"] | "");
+            if (!cameraInRange(args)) {
+                return "no such camera";
+            }
+            if (!encodeCameraCommand(compiler.topicId, args, compiler)) {
+                return "unsupported topic";
+            }
+        }
+    }
+    compiler.put(OP_END);
+    return compiler.overflow ? "too large" : nullptr;
+}
+
+bool defineMacro(const byte* payload, unsigned int length) {
+    JsonDocument& document = defineDocument;
+    DeserializationError jsonError = deserializeJson(document, payload, length);
+    const char* name = document["name"] | "";
+    if (jsonError) {
+        report(name, "error", 0, 0, jsonError.c_str());
+        return false;
+    }
+    if (!validName(name)) {
+        report(name, "error", 0, 0, "bad name");
+        return false;
+    }
+
+    // A definition that does not compile leaves the old version, stored and
+    // cached, as it was
+    MacroCompiler check(nullptr);
+    const char* error = compileMacro(document["steps"], check);
+    if (error) {
+        report(name, "error", 0, 0, error);
+        return false;
+    }
+
+    MacroSlot* slot = claimSlot();
+    if (!slot) {
+        report(name, "error", 0, 0, "no cache slot");
+        return false;
+    }
+    MacroCompiler compiler(slot->code);
+    compileMacro(document["steps"], compiler);
+
+    // Written next to the old version and renamed over it, so a failed
+    // write does not cost the old one either
+    char path[48];
+    char tempPath[48];
+    macroPath(name, path, sizeof(path));
+    snprintf(tempPath, sizeof(tempPath), "/macros/%s.tmp", name);
+    LittleFS.mkdir("/macros");
+    File file = LittleFS.open(tempPath, "w");
+    bool written =
+        file && file.write(slot->code, compiler.used) == compiler.used;
+    if (file) {
+        file.close();
+    }
+    if (!written || !LittleFS.rename(tempPath, path)) {
+        LittleFS.remove(tempPath);
+        report(name, "error", 0, 0, "write failed");
+        return false;
+    }
+    forget(name);
+    strlcpy(slot->name, name, sizeof(slot->name));
+    slot->size = compiler.used;
+    slot->lastUsed = millis();
+    report(name, "defined", 0, slot->code[4]);
+    return true;
+}
+
+/*Runner*/
+static void finish(const char* state) {
+    report(run.name, state, run.step, run.steps);
+    run.slot = -1;
+}
+
+bool runMacro(const char* name) {
+    MacroSlot* slot = validName(name) ? loadSlot(name) : nullptr;
+    if (!slot) {
+        report(name, "error", 0, 0, "not found");
+        return false;
+    }
+    if (run.slot >= 0) {
+        finish("stopped");
+    }
+    memset(&run, 0, sizeof(run));
+    run.slot = slot - cache;
+    strlcpy(run.name, name, sizeof(run.name));
+    run.pc = MACRO_HEADER_SIZE;
+    run.steps = slot->code[4];
+    metrics.macroRuns++;
+    return true;
+}
+
+void stopMacro() {
+    if (run.slot >= 0) {
+        finish("stopped");
+    }
+}
+
+bool deleteMacro(const char* name) {
+    char path[48];
+    macroPath(name, path, sizeof(path));
+    if (!validName(name) || !LittleFS.remove(path)) {
+        report(name, "error", 0, 0, "not found");
+        return false;
+    }
+    forget(name);
+    report(name, "deleted", 0, 0);
+    return true;
+}
+
+// Frames that will answer with a completion, broadcasts do not
+static uint8_t countFrames(const uint8_t* frame, uint8_t length) {
+    uint8_t frames = 0;
+    uint8_t start = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        if (frame[i] == 0xFF) {
+            if (frame[start] != 0x88) {
+                frames++;
+            }
+            start = i + 1;
+        }
+    }
+    return frames;
+}
+
+// Only counts, replies still go through the normal handling. Replies do not
+// say which command they answer, so completions of commands from elsewhere
+// count as well.
+void macroOnReply(uint8_t cam, const uint8_t* reply, int length) {
+    if (run.slot < 0 || cam >= NUM_CAMS ||
+        run.completed[cam] >= run.expected[cam]) {
+        return;
+    }
+    if (length == 3 && (reply[1] & 0xF0) == 0x50) {
+        run.completed[cam]++;
+    }
+    // Buffer full is retried by recovery, its completion comes later
+    if (length == 4 && (reply[1] & 0xF0) == 0x60 &&
+        reply[2] != VISCA_ERROR_BUFFER_FULL) {
+        run.completed[cam]++;
+    }
+}
+
+static uint16_t read16(const uint8_t* code) {
+    return code[0] | (code[1] << 8);
+}
+
+void serviceMacros() {
+    if (run.slot < 0) {
+        return;
+    }
+    const uint32_t now = millis();
+    if (run.gating) {
+        uint8_t cam = run.gateCam;
+        if (run.completed[cam] < run.expected[cam]) {
+            if ((int32_t)(now - run.waitUntil) >= 0) {
+                metrics.macroGateTimeouts++;
+                finish("timeout");
+            }
+            return;
+        }
+        run.gating = false;
+    }
+    if (run.waiting) {
+        if ((int32_t)(now - run.waitUntil) < 0) {
+            return;
+        }
+        run.waiting = false;
+    }
+
+    const MacroSlot& slot = cache[run.slot];
+    const uint8_t* code = slot.code;
+    // Runs until the macro has to wait for time, completions or bus space
+    while (run.pc < slot.size) {
+        const uint8_t* op = code + run.pc;
+        const size_t left = slot.size - run.pc;
+        switch (op[0]) {
+            case OP_END:
+                finish("done");
+                return;
+            case OP_STEP:
+                run.step++;
+                run.pc++;
+                report(run.name, "running", run.step, run.steps);
+                break;
+            case OP_FRAME: {
+                if (left < 4 || left < 4u + op[3] ||
+                    op[3] > VISCACOMMAND_MAX_LENGTH) {
+                    finish("error");
+                    return;
+                }
+                const uint8_t cam = op[1];
+                if (cam >= NUM_CAMS) {
+                    // Stored for another bus layout
+                    finish("error");
+                    return;
+                }
+                if (buses[cameraBus(cam)].queueCount >= VISCA_BUS_QUEUE) {
+                    return;
+                }
+                VISCACommand command;
+                command.len = op[3];
+                memcpy(command.payload, op + 4, command.len);
+                // Quarantined cameras drop it, nothing to wait for then
+                if (busEnqueue(cam, command, (TopicId)op[2])) {
+                    run.expected[cam] += countFrames(command.payload,
+                                                     command.len);
+                }
+                metrics.macroFrames++;
+                run.pc += 4 + command.len;
+                break;
+            }
+            case OP_SHADOW: {
+                if (left < 10 || op[1] >= NUM_CAMS) {
+                    finish("error");
+                    return;
+                }
+                PTZCam target = cams[op[1]];
+                target.setX((int16_t)read16(op + 2));
+                target.setY((int16_t)read16(op + 4));
+                target.setZ((int16_t)read16(op + 6));
+                target.setFocus((int16_t)read16(op + 8));
+                cams[op[1]] = target;
+                run.pc += 10;
+                break;
+            }
+            case OP_WAIT:
+                if (left < 3) {
+                    finish("error");
+                    return;
+                }
+                run.waiting = true;
+                run.waitUntil = now + read16(op + 1);
+                run.pc += 3;
+                return;
+            case OP_GATE:
+                if (left < 4 || op[1] >= NUM_CAMS) {
+                    finish("error");
+                    return;
+                }
+                run.gating = true;
+                run.gateCam = op[1];
+                run.waitUntil = now + read16(op + 2);
+                run.pc += 4;
+                return;
+            default:
+                finish("error");
+                return;
+        }
+    }
+    finish("error");
+}
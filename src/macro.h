@@ -0,0 +1,34 @@
+#include <Arduino.h>
+#pragma once
+
+// Macros are compiled once on define into bytecode of ready-made VISCA frames,
+// waits and completion gates, stored as /macros/<name>.vmc in LittleFS and
+// run from a small RAM cache by serviceMacros().
+#define MACRO_NAME_LENGTH 24
+#define MACRO_MAX_SIZE 1024
+#define MACRO_CACHE_SLOTS 2
+// Define messages are parsed on their own, they are much larger than commands
+#define MACRO_JSON_SIZE 4096
+#define MACRO_GATE_TIMEOUT_MS 5000
+#define MACRO_VERSION 1
+
+// Bytecode, after a "VMC" + version + step count header
+enum MacroOp : uint8_t {
+    OP_END = 0,
+    OP_STEP,    // start of the next step, reported as progress
+    OP_FRAME,   // cam, topic ID, length, VISCA frame(s)
+    OP_SHADOW,  // cam, x, y, z, focus as int16: PTZCam shadow after a moveto
+    OP_WAIT,    // uint16 ms
+    OP_GATE,    // cam, uint16 timeout ms: wait for the cam's completions
+};
+
+// Receives a JSON message for every define, progress step and outcome,
+// main.cpp publishes them on return/system/macro
+void setMacroCallback(void (*callback)(const char* message));
+
+bool defineMacro(const byte* payload, unsigned int length);
+bool runMacro(const char* name);
+void stopMacro();
+bool deleteMacro(const char* name);
+void macroOnReply(uint8_t cam, const uint8_t* reply, int length);
+void serviceMacros();
@@ -10,19 +10,29 @@
 #include <DNSServer.h>
 #include <ESP8266WebServer.h>
 #include <PubSubClient.h>
-#include <SoftwareSerial.h>
 #include <WiFiManager.h>  //https://github.com/tzapu/WiFiManager
 #include <WiFiUdp.h>
 
+#include <bus.h>
 #include <camera.h>
 #include <commands.h>
-
-SoftwareSerial visca(D1,D2);
-
-
-void debugPrint(String prompt) {}
-void debugPrintln(String prompt) { debugPrint(prompt + "\n"); }
-void handleSerial();
+#include <console.h>
+#include <macro.h>
+#include <metrics.h>
+#include <recovery.h>
+#include <scheduler.h>
+#include <state.h>
+#include <topics.h>
+#include <trace.h>
+#include <velocity.h>
+#include <websocket.h>
+
+
+void debugPrint(const char* prompt) {}
+void debugPrintln(const char* prompt) {
+    debugPrint(prompt);
+    debugPrint("\n");
+}
 
 
 long lastRequestTime = 0;
@@ -31,30 +41,66 @@ long lastRequestTime = 0;
 bool shouldSaveConfig = false;
 
 void callback(char* topic, byte* payload, unsigned int length);
+void startPortal();
+const char* buildTopic(const char* subTopic);
+bool publish(const char* subTopic, const char* message);
+bool publish(const char* subTopic, const uint8_t* payload, unsigned int length);
 
 // define your default values here, if there are different values in
-// config.json, they are overwritten. char mqtt_server[40];
-String mqtt_server;
+// config.json, they are overwritten.
+// Fixed buffers on purpose: the message path runs for days, and every String
+// left on it fragments the heap a little more.
+#define TOPIC_MAX_LENGTH 96
+char mqtt_server[41];
 uint16_t mqtt_port;
-String mqtt_user;
-String mqtt_password;
-String mqtt_basetopic;
+char mqtt_user[41];
+char mqtt_password[41];
+char mqtt_basetopic[41];
+
+// Commands are parsed into the same document every time instead of a fresh
+// heap allocation per message.
+StaticJsonDocument<1024> commandDocument;
 
 WiFiClient espClient;
 PubSubClient client(espClient);
 
+// Boot does not wait for the network: cameras and the USB console work right
+// after setup(), Wi-Fi and MQTT come up in the background from loop().
+// The config portal only opens when the saved network has not shown up
+// within WIFI_CONNECT_TIMEOUT_MS, or right away when there is none.
+// Connecting to the broker blocks loop() for at most MQTT_CONNECT_TIMEOUT_MS
+// when it is down, MQTT_SOCKET_TIMEOUT_S when it accepts but does not answer.
+#define WIFI_CONNECT_TIMEOUT_MS 20000
+#define MQTT_CONNECT_TIMEOUT_MS 250
+#define MQTT_SOCKET_TIMEOUT_S 1
+enum BootStage { BOOT_WIFI, BOOT_MQTT };
+BootStage bootStage = BOOT_WIFI;
+unsigned long wifiStarted = 0;
+bool portalStarted = false;
+unsigned long lastReconnectAttempt = 0;
+
+// Global, the non-blocking portal keeps using them after setup()
+WiFiManager wifiManager;
+WiFiManagerParameter custom_mqtt_server("server", "mqtt server", "", 40);
+WiFiManagerParameter custom_mqtt_port("port", "mqtt port", "", 6);
+WiFiManagerParameter custom_mqtt_user("user", "mqtt user", "", 40);
+WiFiManagerParameter custom_mqtt_password("password", "mqtt password", "", 40);
+WiFiManagerParameter custom_mqtt_basetopic("basetopic", "mqtt basetopic", "", 40);
+
 // callback notifying us of the need to save config
 void saveConfigCallback() {
     debugPrintln("Should save config");
     shouldSaveConfig = true;
 }
 void setup() {
+    // VISCA and the console first, they do not need anything else
     Serial.begin(9600);
-    visca.begin(9600);
+    beginBuses();
+    beginConsole();
     // put your setup code here, to run once:
     
     debugPrint("MAC: ");
-    debugPrintln(WiFi.macAddress());
+    debugPrintln(WiFi.macAddress().c_str());
     WiFi.mode(WIFI_STA);
     // clean FS for testing
 
@@ -78,11 +124,11 @@ void setup() {
                 DeserializationError deserializeError = deserializeJson(jsonBuffer,buf.get());
                 if (!deserializeError) {
                     debugPrintln("\nparsed json");
-                    mqtt_server = String(jsonBuffer["mqtt_server"]);
-                    mqtt_port = String(jsonBuffer["mqtt_port"]).toInt();
-                    mqtt_user = String(jsonBuffer["mqtt_user"]);
-                    mqtt_password = String(jsonBuffer["mqtt_password"]);
-                    mqtt_basetopic = String(jsonBuffer["mqtt_basetopic"]);
+                    strlcpy(mqtt_server, jsonBuffer["mqtt_server"] | "", sizeof(mqtt_server));
+                    mqtt_port = jsonBuffer["mqtt_port"].as<int>();
+                    strlcpy(mqtt_user, jsonBuffer["mqtt_user"] | "", sizeof(mqtt_user));
+                    strlcpy(mqtt_password, jsonBuffer["mqtt_password"] | "", sizeof(mqtt_password));
+                    strlcpy(mqtt_basetopic, jsonBuffer["mqtt_basetopic"] | "", sizeof(mqtt_basetopic));
                 } else {
                     debugPrintln("failed to load json config");
                 }
@@ -96,21 +142,24 @@ void setup() {
     // The extra parameters to be configured (can be either global or just in
     // the setup) After connecting, parameter.getValue() will get you the
     // configured value id/name placeholder/prompt default length
-    if(mqtt_basetopic == "") {
-        const char* mqtt_basetopic = "VISCA";
-        Serial.println(mqtt_basetopic);
-    } 
+    if(mqtt_basetopic[0] == '\0') {
+        strlcpy(mqtt_basetopic, "VISCA", sizeof(mqtt_basetopic));
+    }
+    char mqtt_port_text[6];
+    snprintf(mqtt_port_text, sizeof(mqtt_port_text), "%u", mqtt_port);
 
-    WiFiManagerParameter custom_mqtt_server("server", "mqtt server",mqtt_server.c_str(), 40);
-    WiFiManagerParameter custom_mqtt_port("port", "mqtt port", String(mqtt_port).c_str(), 6);
-    WiFiManagerParameter custom_mqtt_user("user", "mqtt user", mqtt_user.c_str(), 40);
-    WiFiManagerParameter custom_mqtt_password("password", "mqtt password", mqtt_password.c_str(), 40);
-    WiFiManagerParameter custom_mqtt_basetopic("basetopic", "mqtt basetopic", mqtt_basetopic.c_str(), 128);
+    custom_mqtt_server.setValue(mqtt_server, 40);
+    custom_mqtt_port.setValue(mqtt_port_text, 6);
+    custom_mqtt_user.setValue(mqtt_user, 40);
+    custom_mqtt_password.setValue(mqtt_password, 40);
+    custom_mqtt_basetopic.setValue(mqtt_basetopic, 40);
 
     // WiFiManager
-    // Local intialization. Once its business is done, there is no need to keep
-    // it around
-    WiFiManager wifiManager;
+    // Its log output would end up in the middle of the console
+    wifiManager.setDebugOutput(false);
+    wifiManager.setConfigPortalBlocking(false);
+    // Used when credentials entered in the portal are tried
+    wifiManager.setConnectTimeout(WIFI_CONNECT_TIMEOUT_MS / 1000);
 
     // Reset Wifi settings for testing
     //  wifiManager.resetSettings();
@@ -143,20 +192,16 @@ void setup() {
     // in seconds
     // wifiManager.setTimeout(120);
 
-    // fetches ssid and pass and tries to connect
-    // if it does not connect it starts an access point with the specified name
-    // here  "AutoConnectAP"
-    // and goes into a blocking loop awaiting configuration
-    if (!wifiManager.autoConnect("KatzenWuerden", "viscakaufen")) {
-        debugPrintln("failed to connect and hit timeout");
-        delay(3000);
-        // reset and try again, or maybe put it to deep sleep
-        ESP.reset();
-        delay(5000);
+    // Not autoConnect(): even with a non-blocking portal it first waits for
+    // the saved network for up to its connect timeout. WiFi.begin() with the
+    // saved credentials returns right away, serviceNetwork() opens the portal
+    // if that does not get anywhere.
+    WiFi.begin();
+    wifiStarted = millis();
+    if (!wifiManager.getWiFiIsSaved()) {
+        startPortal();
     }
 
-    // if you get here you have connected to the WiFi
-    debugPrintln("connected...yeey :)");
     // Port defaults to 8266
     // ArduinoOTA.setPort(8266);
 
@@ -181,11 +226,29 @@ void setup() {
         else if (error == OTA_END_ERROR)
             debugPrintln("End Failed");
     });
+
+    client.setCallback(callback);
+    setStateCallback([](CommandOrigin origin, const char* message) {
+        reply(origin, "return/camera/state", message);
+    });
+    setRecoveryCallback([](const char* message) {
+        publish("return/camera/error", message);
+    });
+    setMacroCallback([](const char* message) {
+        publish("return/system/macro", message);
+    });
+}
+
+// Everything that needs the network, run once Wi-Fi is up
+void startNetwork() {
+    debugPrintln("connected...yeey :)");
+    metrics.wifiUpMs = millis();
     ArduinoOTA.begin();
+    beginWebSocket();
 
     // read updated parameters
-    mqtt_server = custom_mqtt_server.getValue();
-    mqtt_port = String(custom_mqtt_port.getValue()).toInt();
+    strlcpy(mqtt_server, custom_mqtt_server.getValue(), sizeof(mqtt_server));
+    mqtt_port = atoi(custom_mqtt_port.getValue());
 
     // save the custom parameters to FS
     if (shouldSaveConfig) {
@@ -217,239 +280,356 @@ void setup() {
     }
     debugPrintln("local ip");
     //uint16_t mqtt_port_x = 1883;
-    client.setServer(mqtt_server.c_str(), mqtt_port);
-
-    client.setCallback(callback);
+    client.setServer(mqtt_server, mqtt_port);
+    // WiFiClient uses its Stream timeout for connect(), 5 s by default
+    espClient.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+    client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    // Metrics, config replies and macro definitions do not fit the default
+    // 256 bytes
+    client.setBufferSize(2048);
 }
 
-String buildTopic(const char* subTopic) {
-    if(mqtt_basetopic == ""){
-        mqtt_basetopic = "VISCA";
+// Returns a shared buffer, only valid until the next call.
+const char* buildTopic(const char* subTopic) {
+    static char newTopic[TOPIC_MAX_LENGTH];
+    if(mqtt_basetopic[0] == '\0'){
+        strlcpy(mqtt_basetopic, "VISCA", sizeof(mqtt_basetopic));
     }
-    String newTopic = String(mqtt_basetopic) + "/" + String(subTopic);
+    snprintf(newTopic, sizeof(newTopic), "%s/%s", mqtt_basetopic, subTopic);
     return newTopic;
 }
+// Publishes below the base topic. What PubSubClient and lwIP allocate for it
+// is counted as network allocations, see metrics.h.
+bool publish(const char* subTopic, const uint8_t* payload,
+             unsigned int length) {
+    beginNetworkCall();
+    bool sent = client.publish(buildTopic(subTopic), payload, length);
+    endNetworkCall();
+    return sent;
+}
+bool publish(const char* subTopic, const char* message) {
+    return publish(subTopic, (const uint8_t*)message, strlen(message));
+}
+// Answers go back where the command came from: the broker, the WebSocket
+// client that sent it or the USB console
+void reply(CommandOrigin origin, const char* subTopic, const char* message) {
+    if (origin.source == TRACE_WEBSOCKET) {
+        webSocketReply(origin.client, subTopic, message);
+    } else if (origin.source == TRACE_CONSOLE) {
+        consoleReply(subTopic, message);
+    } else {
+        publish(subTopic, message);
+    }
+}
 
 void reconnect() {
-    // Loop until we're reconnected
-    while (!client.connected()) {
-        debugPrint("Attempting MQTT connection...");
+    // One attempt every 5 seconds, loop() keeps running in between
+    if (lastReconnectAttempt != 0 && millis() - lastReconnectAttempt < 5000) {
+        return;
+    }
+    lastReconnectAttempt = millis();
+    debugPrint("Attempting MQTT connection...");
 
-        // Attempt to connect
-        // If you do not want to use a username and password, change next line
-        // to if (client.connect("ESP8266Client")) {
+    // Attempt to connect
+    // If you do not want to use a username and password, change next line
+    // to if (client.connect("ESP8266Client")) {
 
-        String clientId = "VISCABridge-";
-        clientId += String(random(0xffff), HEX);
-        if (client.connect(clientId.c_str())) {
-            debugPrint("connected");
+    char clientId[20];
+    snprintf(clientId, sizeof(clientId), "VISCABridge-%lx", random(0xffff));
+    if (client.connect(clientId)) {
+        debugPrint("connected");
 
-            client.subscribe(buildTopic("#").c_str());
-            client.publish(buildTopic("system/status").c_str(), "ready");
+        // Only the command subtrees, everything under return/ is our own
+        // output and would just bounce back into callback()
+        client.subscribe(buildTopic("command/camera/#"));
+        client.subscribe(buildTopic("command/system/#"));
+        publish("system/status", "ready");
+        metrics.mqttUpMs = millis();
 
-        } else {
-            debugPrint("failed, rc=");
-            debugPrintln(" try again in 5 seconds");
-            // Wait 5 seconds before retrying
-            delay(5000);
-        }
+    } else {
+        debugPrint("failed, rc=");
+        debugPrintln(" try again in 5 seconds");
+    }
+}
+void startPortal() {
+    // Non-blocking, loop() keeps it going with wifiManager.process()
+    wifiManager.startConfigPortal("KatzenWuerden", "viscakaufen");
+    portalStarted = true;
+}
+void serviceNetwork() {
+    switch (bootStage) {
+        case BOOT_WIFI:
+            if (portalStarted) {
+                wifiManager.process();
+            }
+            if (WiFi.status() == WL_CONNECTED) {
+                if (portalStarted) {
+                    // The saved network came up after all. BOOT_MQTT does not
+                    // run process(), so the access point would stay up unserved
+                    wifiManager.stopConfigPortal();
+                    portalStarted = false;
+                }
+                startNetwork();
+                bootStage = BOOT_MQTT;
+            } else if (!portalStarted &&
+                       millis() - wifiStarted > WIFI_CONNECT_TIMEOUT_MS) {
+                startPortal();
+            }
+            break;
+
+        case BOOT_MQTT:
+            if (!client.connected()) {
+                reconnect();
+            }
+            client.loop();
+            ArduinoOTA.handle();
+            serviceWebSocket();
+            break;
     }
 }
 void loop() {
-    if (!client.connected()) {
-        reconnect();
+    serviceConsole();
+    serviceBuses();
+    serviceState();
+    serviceRecovery();
+    serviceMacros();
+    ScheduleReport report;
+    if (runScheduler(report)) {
+        char message[96];
+        snprintf(message, sizeof(message),
+                 "{\"at\":%lu,\"frames\":%u,\"late_ms\":%lu,\"skew_us\":%lu}",
+                 (unsigned long)report.at, report.frames,
+                 (unsigned long)report.lateMs, (unsigned long)report.skewUs);
+        publish("return/system/schedule", message);
     }
-    client.loop();
-    ArduinoOTA.handle();
-    handleSerial();
     if (lastRequestTime + 1000 < millis()) {
         lastRequestTime = millis();
         requestEverything();
     }
+    serviceNetwork();
 }
-void parseCommand(uint8_t* command, int length) {
-    if (command[0] == 0x90 && command[1] == 0x50 &&
-        command[2] == 0xFF) {
+void parseCommand(uint8_t cam, uint8_t* command, int length) {
+    const uint32_t allocationsBefore = allocationCount();
+    metrics.replies++;
+    traceRecord(TRACE_RX, cam, TOPIC_UNKNOWN, TRACE_OK, command, length);
+    macroOnReply(cam, command, length);
+    if (recoveryOnReply(cam, command, length)) {
+        // Decoded and answered on return/camera/error
+        return;
+    }
+    if (length == 3 && command[1] == 0x50) {
+        return;
+    }
+    if (stateOnReply(cam, command, length)) {
+        // Answered on return/camera/state
         return;
     }
 
-    client.publish(buildTopic("return/camera/raw").c_str(), command, length);
-    client.publish(buildTopic("return/camera/length").c_str(), String(length).c_str());
-
+    char lengthText[8];
+    snprintf(lengthText, sizeof(lengthText), "%d", length);
+    publish("return/camera/raw", command, length);
+    publish("return/camera/length", lengthText);
+    countAllocations(allocationsBefore, client.connected());
 }
-void handleSerial() {
-    static enum { IDLE, RECEIVING } state = IDLE;
-    static uint8_t buff[17] = {0};
-    static int buffIndex = 0;
-    while (visca.available() > 0) {
-        uint8_t receivedByte = visca.read();
-        Serial.println(receivedByte);
-        client.publish("VISCA/return/camera/mqtt/", "Reading Data:");
-        client.publish("VISCA/return/camera/mqtt/", String(receivedByte, HEX).c_str());
-        switch (state) {
-            case IDLE:
-                if (receivedByte == 0x90) {
-                    state = RECEIVING;
-                    buffIndex = 0;
-                    buff[buffIndex++] = receivedByte;
-                }
-                break;
-
-            case RECEIVING:
-                buff[buffIndex++] = receivedByte;
-                if (receivedByte == 0xff) {
-                    // Full command received, call parseCommand
-                    parseCommand(buff, buffIndex);
-                    state = IDLE;
-                }
-                break;
+// Queues a command on its camera's bus, or parks it in the scheduler when it
+// carries a target time on the bridge clock that has not been reached yet.
+// Returns false when it was dropped.
+bool sendCommand(const VISCACommand& command, uint8_t cam, uint32_t at,
+                 TopicId topicId, CommandOrigin origin) {
+    if (at == 0 || (int32_t)(at - bridgeMillis()) <= 0) {
+        if (busEnqueue(cam, command, topicId)) {
+            return true;
         }
-
+        if (cameraAvailable(cam)) {
+            reply(origin, "return/system", "Bus queue full, command dropped");
+        } else {
+            reply(origin, "return/system",
+                  "Camera quarantined, command dropped");
+        }
+        return false;
     }
+    if (!scheduleCommand(command, cam, at, topicId)) {
+        traceRecord(TRACE_TX, cam, topicId, TRACE_DROPPED, command.payload,
+                    command.len);
+        reply(origin, "return/system", "Scheduler full, command dropped");
+        return false;
+    }
+    traceRecord(TRACE_TX, cam, topicId, TRACE_SCHEDULED, command.payload,
+                command.len);
+    return true;
 }
+// Live commands go out right away (or at their "at" time) and update the
+// PTZCam shadow state
+struct LiveSink : CommandSink {
+    uint32_t at;
+    TopicId topicId;
+    CommandOrigin origin;
+    VISCACommand last;
+    bool dropped = false;
+
+    LiveSink(uint32_t at, TopicId topicId, CommandOrigin origin)
+        : at(at), topicId(topicId), origin(origin) {}
+    void frame(uint8_t cam, const VISCACommand& command) override {
+        last = command;
+        if (!sendCommand(command, cam, at, topicId, origin)) {
+            dropped = true;
+        }
+    }
+    void shadow(uint8_t cam, const PTZCam& target) override {
+        cams[cam] = target;
+    }
+};
 void callback(char* topic, byte* payload, unsigned int length) {
-    /*Preparation for sourcing out into commands.cpp*/
-    //handleCommands(topic, payload, length);
-    DynamicJsonDocument response(1024);
-    deserializeJson(response,payload);
-    JsonObject responseObject = response.as<JsonObject>();
-    if (!responseObject.containsKey("cam")) {
-        responseObject["cam"] = 0;
+    metrics.messages++;
+    TopicId topicId = TOPIC_UNKNOWN;
+    const size_t baseLength = strlen(mqtt_basetopic);
+    if (strncmp(topic, mqtt_basetopic, baseLength) == 0 &&
+        topic[baseLength] == '/') {
+        topicId = classifyTopic(topic + baseLength + 1);
     }
-    //uint8_t camNum = responseObject["cam"].as<uint8_t>();
-
-    if (strcmp(topic, buildTopic("command/camera/raw").c_str()) == 0) {
-
-        visca.write(payload, length);
-        const uint focus = responseObject["focus"];
-        byte focusValues[4];
-        convertValues(focus, focusValues);
-        for(int i =0; i < 4; i++){
-            client.publish("VISCA/return/dev",String(focusValues[i]).c_str());            
-        }
-
-        client.publish(buildTopic("return/camera/status").c_str(),
-                       ("Kotze Daten " + String(length)).c_str());
+    dispatchCommand(topicId, payload, length, {TRACE_MQTT, 0});
+}
+// Every command source (MQTT, WebSocket, console) ends up here with the topic
+// already classified. origin.source is the TraceKind recorded for the message.
+TraceOutcome dispatchCommand(TopicId topicId, byte* payload,
+                             unsigned int length, CommandOrigin origin) {
+    const uint8_t source = origin.source;
+    const uint32_t allocationsBefore = allocationCount();
+    // Classified before any parsing: echoes of our own return/ output and
+    // anything else we have no handler for cost a table lookup, nothing more
+    if (topicId == TOPIC_UNKNOWN) {
+        metrics.droppedMessages++;
+        traceRecord(source, 0, topicId, TRACE_UNKNOWN_TOPIC, payload, length);
+        return TRACE_UNKNOWN_TOPIC;
     }
 
-    if (strcmp(topic, buildTopic("command/camera/blinkenlights").c_str()) == 0) {
-
-        VISCACommand command =
-            blinkenlights(responseObject["led"].as<uint8_t>(),
-                          responseObject["mode"].as<uint8_t>(),
-                          responseObject["cam"].as<uint8_t>());
-        visca.write(command.payload, command.len);
+    if (metrics.firstCommandMs == 0) {
+        metrics.firstCommandMs = max(millis(), 1UL);
     }
 
-    if (strcmp(topic, buildTopic("command/camera/settings").c_str()) == 0) {
-
-        if (responseObject.containsKey("backlight")) {
-            VISCACommand command =
-                backlight(responseObject["backlight"].as<bool>(),
-                          responseObject["cam"].as<uint8_t>());
-            visca.write(command.payload, command.len);
-        }
-
-        if (responseObject.containsKey("mirror")) {
-            VISCACommand command = mirror(responseObject["mirror"].as<bool>(),
-                                          responseObject["cam"].as<uint8_t>());
-            visca.write(command.payload, command.len);
-        }
-        if (responseObject.containsKey("flip")) {
-            VISCACommand command = flip(responseObject["flip"].as<bool>(),
-                                        responseObject["cam"].as<uint8_t>());
-            visca.write(command.payload, command.len);
-        }
-
-        if (responseObject.containsKey("mmdetect")) {
-            VISCACommand command =
-                mmdetect(responseObject["mmdetect"].as<bool>(),
-                         responseObject["cam"].as<uint8_t>());
-            visca.write(command.payload, command.len);
+    if (topicId == TOPIC_CAMERA_RAW || topicId == TOPIC_CAMERA_RAW_BUS1 ||
+        topicId == TOPIC_CAMERA_RAW_BUS2) {
+        // Raw frames are not JSON, so no cam: the topic picks the bus
+        // (command/camera/raw/<bus>, plain raw is bus 0) and the header byte
+        // the camera on it
+        const uint8_t bus = topicId == TOPIC_CAMERA_RAW
+                                ? 0
+                                : topicId - TOPIC_CAMERA_RAW_BUS1 + 1;
+        char status[24];
+        const TraceOutcome outcome =
+            bus >= VISCA_BUSES ? TRACE_DROPPED : TRACE_OK;
+        traceRecord(source, 0, topicId, outcome, payload, length);
+        if (outcome == TRACE_DROPPED) {
+            snprintf(status, sizeof(status), "No bus %u", bus);
+        } else {
+            busWriteRaw(bus, payload, length);
+            snprintf(status, sizeof(status), "Kotze Daten %u", length);
         }
-
-        //  ir_output, ir_cameracontrol
+        reply(origin, "return/camera/status", status);
+        countAllocations(allocationsBefore, client.connected());
+        return outcome;
     }
 
+    if (topicId == TOPIC_SYSTEM_MACRO_DEFINE) {
+        traceRecord(source, 0, topicId, TRACE_OK, payload, length);
+        // Too large for commandDocument, parsed and answered in macro.cpp
+        defineMacro(payload, length);
+        countAllocations(allocationsBefore, client.connected());
+        return TRACE_OK;
+    }
 
-    if (strcmp(topic, buildTopic("command/camera/picture").c_str()) == 0) {
-
-        if (responseObject.containsKey("wb")) {
-            VISCACommand command = wb(responseObject["wb"].as<int>(),
-                                      responseObject["cam"].as<uint8_t>());
-            visca.write(command.payload, command.len);
-        }
-        if (responseObject.containsKey("iris")) {
-            VISCACommand command = iris(responseObject["iris"].as<int>(),
-                                        responseObject["cam"].as<uint8_t>());
-            visca.write(command.payload, command.len);
-        }
+    metrics.jsonParses++;
+    JsonDocument& response = commandDocument;
+    // const input, so ArduinoJson copies strings instead of rewriting payload
+    DeserializationError jsonError =
+        deserializeJson(response, (const byte*)payload, length);
+    // No payload at all counts as {}, anything else that does not parse is
+    // not guessed at
+    if (jsonError == DeserializationError::EmptyInput) {
+        response.to<JsonObject>();
+    } else if (jsonError) {
+        traceRecord(source, 0, topicId, TRACE_BAD_JSON, payload, length);
+        char message[64];
+        snprintf(message, sizeof(message), "Bad JSON, command dropped: %s",
+                 jsonError.c_str());
+        reply(origin, "return/system", message);
+        countAllocations(allocationsBefore, client.connected());
+        return TRACE_BAD_JSON;
+    }
+    JsonObject responseObject = response.as<JsonObject>();
+    if (cameraTopic(topicId) && !cameraInRange(responseObject)) {
+        // Wrapping it onto a real camera would move the wrong one
+        traceRecord(source, 0, topicId, TRACE_DROPPED, payload, length);
+        reply(origin, "return/system", "No such camera, command dropped");
+        countAllocations(allocationsBefore, client.connected());
+        return TRACE_DROPPED;
+    }
+    traceRecord(source, 0, topicId, TRACE_OK, payload, length);
+    if (!responseObject.containsKey("cam")) {
+        responseObject["cam"] = 0;
+    }
+    //uint8_t camNum = responseObject["cam"].as<uint8_t>();
+    uint32_t at = 0;
+    if (responseObject.containsKey("at")) {
+        at = responseObject["at"].as<uint32_t>();
     }
 
-    if (strcmp(topic, buildTopic("command/camera/moveto").c_str()) == 0) {
-        Serial.println(responseObject.containsKey("x"));
-        if (responseObject.containsKey("x")) {
-            Serial.println(String(responseObject["cam"].as<uint8_t>()).c_str());
-            Serial.println(String(responseObject["x"].as<int>()).c_str());
-            cams[responseObject["cam"].as<uint8_t>()].setX(
-                responseObject["x"].as<int>());
-        }
-        if (responseObject.containsKey("y")) {
-            cams[responseObject["cam"].as<uint8_t>()].setY(
-                responseObject["y"].as<int>());
+    LiveSink sink(at, topicId, origin);
+    if (encodeCameraCommand(topicId, responseObject, sink) &&
+        topicId == TOPIC_CAMERA_MOVEBY) {
+        // Below return/, outside our own subscriptions
+        publish("return/camera/rawdata", sink.last.payload, sink.last.len);
+    }
+    if (topicId == TOPIC_CAMERA_VELOCITYCONFIG) {
+        VelocityConfig config = velocityConfig;
+        if (responseObject.containsKey("deadzone")) {
+            config.deadzone = responseObject["deadzone"].as<uint8_t>();
         }
-        if (responseObject.containsKey("z")) {
-            cams[responseObject["cam"].as<uint8_t>()].setZ(
-                responseObject["z"].as<int>());
+        if (responseObject.containsKey("expo")) {
+            config.expo = responseObject["expo"].as<uint8_t>();
         }
-        if (responseObject.containsKey("focus")) {
-            cams[responseObject["cam"].as<uint8_t>()].setFocus(
-                responseObject["focus"].as<int>());
+        if (responseObject.containsKey("tele")) {
+            config.teleScale = responseObject["tele"].as<uint8_t>();
         }
-        VISCACommand command = movement(responseObject["cam"].as<uint8_t>());
-
-        visca.write(command.payload, command.len);
+        setVelocityConfig(config);
     }
-
-
-    if (strcmp(topic, buildTopic("command/camera/moveby").c_str()) == 0) {
-
-        if (!responseObject.containsKey("x")) {
-            responseObject["x"] = 0;
+    if (topicId == TOPIC_CAMERA_GETSTATE) {
+        uint32_t maxAge = STATE_DEFAULT_MAX_AGE_MS;
+        if (responseObject.containsKey("maxAge")) {
+            maxAge = responseObject["maxAge"].as<uint32_t>();
         }
-        if (!responseObject.containsKey("y")) {
-            responseObject["y"] = 0;
-        }
-
-        VISCACommand command = relativeMovement(
-            responseObject["x"].as<int>(), responseObject["y"].as<int>(),
-            responseObject["cam"].as<uint8_t>());
-
-        visca.write(command.payload, command.len);
-
-        client.publish(buildTopic("command/camera/rawdata").c_str(), command.payload, command.len);
-
+        requestState(responseObject["cam"].as<uint8_t>(), maxAge,
+                     responseObject["id"].as<uint32_t>(), origin);
     }
-    if (strcmp(topic, buildTopic("command/camera/clearBuffer").c_str()) == 0) {
-        VISCACommand command = clearBuffer(responseObject["cam"].as<uint8_t>());
-
-        visca.write(command.payload, command.len);
+    if (topicId == TOPIC_CAMERA_ERRORS) {
+        uint8_t cam = responseObject["cam"].as<uint8_t>();
+        const CameraErrors& errors = cameraErrors(cam);
+        char message[256];
+        snprintf(message, sizeof(message),
+                 "{\"cam\":%u,\"length\":%lu,\"syntax\":%lu,\"bufferFull\":%lu,"
+                 "\"cancelled\":%lu,\"noSocket\":%lu,\"notExecutable\":%lu,"
+                 "\"other\":%lu,\"lastSocket\":%u,\"retries\":%lu,"
+                 "\"clears\":%lu,\"quarantined\":%s}",
+                 cam, (unsigned long)errors.length, (unsigned long)errors.syntax,
+                 (unsigned long)errors.bufferFull,
+                 (unsigned long)errors.cancelled,
+                 (unsigned long)errors.noSocket,
+                 (unsigned long)errors.notExecutable,
+                 (unsigned long)errors.other, errors.lastSocket,
+                 (unsigned long)errors.retries, (unsigned long)errors.clears,
+                 errors.quarantined ? "true" : "false");
+        reply(origin, "return/camera/errors", message);
     }
-    if (strcmp(topic, buildTopic("command/camera/setAddress").c_str()) == 0) {
-        VISCACommand command = setAddress(responseObject["cam"].as<uint8_t>(), responseObject["address"].as<int>());
-
-        visca.write(command.payload, command.len);
-    }
-    if (strcmp(topic, buildTopic("command/system/resetConfig").c_str()) == 0) {
+    if (topicId == TOPIC_SYSTEM_RESETCONFIG) {
         if (responseObject.containsKey("reset") && responseObject["reset"]) {
-            client.publish(buildTopic("return/system").c_str(),"Device configuration deleted");
+            reply(origin, "return/system", "Device configuration deleted");
             ESP.eraseConfig();
             delay(2000);
             ESP.restart();
         }
         
     }
-    if (strcmp(topic, buildTopic("command/system/updateConfig").c_str()) == 0) {
+    if (topicId == TOPIC_SYSTEM_UPDATECONFIG) {
 
         File existingConfigFile = LittleFS.open("/config.json", "r");
         File newConfigFile = LittleFS.open("/config.json", "r+");
@@ -475,7 +655,7 @@ void callback(char* topic, byte* payload, unsigned int length) {
                 }
                 /*upcoming error handling
                 else {
-                    client.publish(buildTopic("return/system").c_str(),"No new settings written. Sad :(");
+                    publish("return/system", "No new settings written. Sad :(");
                 }*/
             }
             String mqttResponse;
@@ -484,31 +664,63 @@ void callback(char* topic, byte* payload, unsigned int length) {
             //existingBuffer.printTo(newConfigFile);
             serializeJsonPretty(existingBuffer, mqttResponse);
             serializeJson(existingBuffer,newConfigFile);
-            client.publish(buildTopic("return/system").c_str(),("New MQTT-Settings: " + mqttResponse).c_str());
+            reply(origin, "return/system",
+                  ("New MQTT-Settings: " + mqttResponse).c_str());
         }
         newConfigFile.close();
         delay(2000);
         ESP.restart();
     }
-    if (strcmp(topic, buildTopic("command/system/getConfig").c_str()) == 0) {
+    if (topicId == TOPIC_SYSTEM_GETCONFIG) {
 
         if (LittleFS.exists("/config.json")) {
             // file exists, reading and loading
             File configFile = LittleFS.open("/config.json", "r");
             if (configFile) {
-                size_t size = configFile.size();
-                std::unique_ptr<char[]> buf(new char[size]);
-                configFile.readBytes(buf.get(), size);
                 StaticJsonDocument<256> existingBuffer;
-                deserializeJson(existingBuffer,buf.get());
+                deserializeJson(existingBuffer,configFile);
                 char mqttResponse[256];
                 serializeJson(existingBuffer, mqttResponse);
-                client.publish(buildTopic("return/system").c_str(),mqttResponse);
+                reply(origin, "return/system", mqttResponse);
             }
         }
     }
-    if (strcmp(topic, buildTopic("command/system/reboot").c_str()) == 0) {
+    if (topicId == TOPIC_SYSTEM_TIME) {
+        if (responseObject.containsKey("time")) {
+            setBridgeTime(responseObject["time"].as<uint32_t>());
+        }
+        char message[32];
+        snprintf(message, sizeof(message), "{\"time\":%lu}",
+                 (unsigned long)bridgeMillis());
+        reply(origin, "return/system/time", message);
+    }
+    if (topicId == TOPIC_SYSTEM_TRACE) {
+        // Streamed, the dump is far bigger than the PubSubClient buffer
+        beginNetworkCall();
+        client.beginPublish(buildTopic("return/system/trace"),
+                            traceDumpSize(), false);
+        traceDump(client);
+        client.endPublish();
+        endNetworkCall();
+    }
+    if (topicId == TOPIC_SYSTEM_METRICS) {
+        // static, too big for the stack
+        static char message[960];
+        formatMetrics(message, sizeof(message));
+        reply(origin, "return/system/metrics", message);
+    }
+    if (topicId == TOPIC_SYSTEM_MACRO_RUN) {
+        runMacro(responseObject["name"] | "");
+    }
+    if (topicId == TOPIC_SYSTEM_MACRO_STOP) {
+        stopMacro();
+    }
+    if (topicId == TOPIC_SYSTEM_MACRO_DELETE) {
+        deleteMacro(responseObject["name"] | "");
+    }
+    if (topicId == TOPIC_SYSTEM_REBOOT) {
         ESP.restart();
     }
-    visca.flush();
+    countAllocations(allocationsBefore, client.connected());
+    return sink.dropped ? TRACE_DROPPED : TRACE_OK;
 }
\ No newline at end of file
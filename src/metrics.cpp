@@ -0,0 +1,105 @@
+#include <Arduino.h>
+#include <metrics.h>
+
+Metrics metrics;
+
+static volatile uint32_t allocations = 0;
+static uint8_t networkCalls = 0;
+
+#ifdef ALLOC_ACCOUNTING
+static void countAllocation() {
+    if (networkCalls > 0) {
+        metrics.networkAllocations++;
+    } else {
+        allocations++;
+    }
+}
+
+// Linked with -Wl,--wrap=malloc etc., every call to the allocator outside of
+// the heap implementation itself ends up here first.
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    countAllocation();
+    return __real_malloc(size);
+}
+void* __wrap_calloc(size_t count, size_t size) {
+    countAllocation();
+    return __real_calloc(count, size);
+}
+void* __wrap_realloc(void* ptr, size_t size) {
+    countAllocation();
+    return __real_realloc(ptr, size);
+}
+}
+#endif
+
+uint32_t allocationCount() { return allocations; }
+
+void beginNetworkCall() { networkCalls++; }
+void endNetworkCall() { networkCalls--; }
+
+void countAllocations(uint32_t before, bool steadyState) {
+    uint32_t allocated = allocations - before;
+    if (!steadyState || allocated == 0) {
+        return;
+    }
+    metrics.steadyAllocations += allocated;
+    metrics.allocatingMessages++;
+}
+
+struct MetricEntry {
+    const char* name;
+    const uint32_t* value;
+};
+
+static const MetricEntry metricTable[] = {
+    {"first_command_ms", &metrics.firstCommandMs},
+    {"wifi_up_ms", &metrics.wifiUpMs},
+    {"mqtt_up_ms", &metrics.mqttUpMs},
+    {"messages", &metrics.messages},
+    {"dropped_messages", &metrics.droppedMessages},
+    {"json_parses", &metrics.jsonParses},
+    {"replies", &metrics.replies},
+    {"steady_allocations", &metrics.steadyAllocations},
+    {"allocating_messages", &metrics.allocatingMessages},
+    {"bus_frames_sent", &metrics.busFramesSent},
+    {"bus_queue_full", &metrics.busQueueFull},
+    {"ws_commands", &metrics.webSocketCommands},
+    {"ws_pushes", &metrics.webSocketPushes},
+    {"ws_backpressure", &metrics.webSocketBackpressure},
+    {"state_requests", &metrics.stateRequests},
+    {"state_hits", &metrics.stateHits},
+    {"state_inquiries", &metrics.stateInquiries},
+    {"state_inquiries_saved", &metrics.stateInquiriesSaved},
+    {"visca_errors", &metrics.viscaErrors},
+    {"recovery_retries", &metrics.recoveryRetries},
+    {"recovery_clears", &metrics.recoveryClears},
+    {"recovery_quarantines", &metrics.recoveryQuarantines},
+    {"recovery_drops", &metrics.recoveryDrops},
+    {"macro_runs", &metrics.macroRuns},
+    {"macro_frames", &metrics.macroFrames},
+    {"macro_loads", &metrics.macroLoads},
+    {"macro_gate_timeouts", &metrics.macroGateTimeouts},
+    {"network_allocations", &metrics.networkAllocations},
+};
+
+size_t formatMetrics(char* out, size_t size) {
+    size_t used = snprintf(out, size, "{\"heap_free\":%lu,\"heap_max_block\":%lu",
+                           (unsigned long)ESP.getFreeHeap(),
+                           (unsigned long)ESP.getMaxFreeBlockSize());
+    for (const MetricEntry& entry : metricTable) {
+        if (used >= size) {
+            break;
+        }
+        used += snprintf(out + used, size - used, ",\"%s\":%lu", entry.name,
+                         (unsigned long)*entry.value);
+    }
+    if (used < size) {
+        used += snprintf(out + used, size - used, "}");
+    }
+    return used < size ? used : size - 1;
+}
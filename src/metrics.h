@@ -0,0 +1,50 @@
+#include <Arduino.h>
+#pragma once
+
+struct Metrics {
+    uint32_t firstCommandMs;      // millis() when the first command was handled
+    uint32_t wifiUpMs;            // millis() when Wi-Fi came up
+    uint32_t mqttUpMs;            // millis() of the last broker connect
+    uint32_t messages;            // MQTT messages handled by callback()
+    uint32_t droppedMessages;     // rejected by topic before any parsing
+    uint32_t jsonParses;          // messages that actually hit deserializeJson
+    uint32_t replies;             // VISCA replies handled by parseCommand()
+    uint32_t steadyAllocations;   // heap allocations on those paths once connected
+    uint32_t allocatingMessages;  // messages/replies that allocated at all
+    uint32_t busFramesSent;       // commands written, summed over all buses
+    uint32_t busQueueFull;        // commands dropped on a full bus queue
+    uint32_t webSocketCommands;   // commands received over the WebSocket
+    uint32_t webSocketPushes;     // camera states pushed to WebSocket clients
+    uint32_t webSocketBackpressure;  // pushes a client could not take
+    uint32_t stateRequests;       // getState requests
+    uint32_t stateHits;           // ... answered from the cache
+    uint32_t stateInquiries;      // inquiries actually sent to a camera
+    uint32_t stateInquiriesSaved; // cache hits plus requests that shared one
+    uint32_t viscaErrors;         // error replies from all cameras
+    uint32_t recoveryRetries;     // buffer full retries scheduled
+    uint32_t recoveryClears;      // automatic IF_Clear after repeated faults
+    uint32_t recoveryQuarantines; // cameras taken out of scheduling
+    uint32_t recoveryDrops;       // commands dropped for quarantined cameras
+    uint32_t macroRuns;           // macros started
+    uint32_t macroFrames;         // VISCA frames sent by macros
+    uint32_t macroLoads;          // macros read from LittleFS, i.e. cache misses
+    uint32_t macroGateTimeouts;   // macros aborted waiting for completions
+    uint32_t networkAllocations;  // heap allocations inside network calls
+};
+
+extern Metrics metrics;
+
+// Number of malloc/calloc/realloc calls since boot. Only counts when the
+// build wraps the allocator (ALLOC_ACCOUNTING, see platformio.ini).
+uint32_t allocationCount();
+void countAllocations(uint32_t before, bool steadyState);
+
+// Brackets calls into PubSubClient, WiFiClient and the WebSocket library.
+// lwIP allocates a pbuf for every packet sent, which is none of our doing,
+// so allocations in between go to networkAllocations instead of
+// allocationCount(). lwIP's own receive path runs between loop() passes
+// and is not seen by either.
+void beginNetworkCall();
+void endNetworkCall();
+
+size_t formatMetrics(char* out, size_t size);
@@ -0,0 +1,294 @@
+#include <Arduino.h>
+#include <bus.h>
+#include <metrics.h>
+#include <recovery.h>
+#include <scheduler.h>
+
+// What a frame's first answer looks like
+enum PendingKind : uint8_t {
+    PENDING_COMMAND = 1,  // ACK, or an error on socket 0
+    PENDING_INQUIRY = 2,  // y0 50 <data> FF
+    PENDING_CLEAR = 4,    // IF_Clear, a bare completion on socket 0
+};
+
+struct PendingFrame {
+    uint8_t kind;
+    uint8_t topicId;
+    uint8_t length;
+    uint8_t payload[RECOVERY_PENDING_FRAME_LENGTH];
+    uint32_t sent;
+};
+
+struct CameraRecovery {
+    CameraErrors errors;
+    // Sent and not answered yet. The camera answers in order, so the oldest
+    // is what an ACK or a buffer full reply refers to.
+    PendingFrame pending[RECOVERY_PENDING_FRAMES];
+    uint8_t pendingHead;
+    uint8_t pendingCount;
+    uint8_t retries;
+    // Faults inside the current window
+    uint32_t windowStart;
+    uint8_t faults;
+    uint8_t clearsWithoutSuccess;
+    uint32_t lastProbe;
+};
+
+static CameraRecovery recovery[NUM_CAMS];
+static void (*recoveryCallback)(const char* message) = nullptr;
+
+void setRecoveryCallback(void (*callback)(const char* message)) {
+    recoveryCallback = callback;
+}
+
+static void report(uint8_t cam, const char* event, uint8_t code,
+                   uint8_t socket) {
+    if (!recoveryCallback) {
+        return;
+    }
+    char message[96];
+    snprintf(message, sizeof(message),
+             "{\"cam\":%u,\"event\":\"%s\",\"code\":%u,\"socket\":%u}", cam,
+             event, code, socket);
+    recoveryCallback(message);
+}
+
+bool cameraAvailable(uint8_t cam) {
+    return cam >= NUM_CAMS || !recovery[cam].errors.quarantined;
+}
+
+const CameraErrors& cameraErrors(uint8_t cam) {
+    return recovery[cam % NUM_CAMS].errors;
+}
+
+static uint8_t pendingKind(const uint8_t* frame, uint8_t length) {
+    if (length >= 5 && frame[1] == 0x01 && frame[2] == 0x00 &&
+        frame[3] == 0x01) {
+        return PENDING_CLEAR;
+    }
+    return length >= 2 && frame[1] == 0x09 ? PENDING_INQUIRY : PENDING_COMMAND;
+}
+
+static void addPending(CameraRecovery& camera, const uint8_t* frame,
+                       uint8_t length, TopicId topicId) {
+    if (length > RECOVERY_PENDING_FRAME_LENGTH) {
+        return;
+    }
+    if (camera.pendingCount == RECOVERY_PENDING_FRAMES) {
+        // Answers got lost, forget the oldest
+        camera.pendingHead = (camera.pendingHead + 1) % RECOVERY_PENDING_FRAMES;
+        camera.pendingCount--;
+    }
+    PendingFrame& entry =
+        camera.pending[(camera.pendingHead + camera.pendingCount) %
+                       RECOVERY_PENDING_FRAMES];
+    entry.kind = pendingKind(frame, length);
+    entry.topicId = topicId;
+    entry.length = length;
+    memcpy(entry.payload, frame, length);
+    entry.sent = millis();
+    camera.pendingCount++;
+}
+
+// Takes the oldest pending frame that an answer of one of the kinds can
+// belong to. Frames before it lost their answer and are dropped, as are
+// frames past the answer timeout.
+static bool takePending(CameraRecovery& camera, uint8_t kinds,
+                        PendingFrame& frame) {
+    const uint32_t now = millis();
+    while (camera.pendingCount > 0) {
+        const PendingFrame& oldest = camera.pending[camera.pendingHead];
+        camera.pendingHead = (camera.pendingHead + 1) % RECOVERY_PENDING_FRAMES;
+        camera.pendingCount--;
+        if ((oldest.kind & kinds) &&
+            now - oldest.sent <= RECOVERY_ANSWER_TIMEOUT_MS) {
+            frame = oldest;
+            return true;
+        }
+    }
+    return false;
+}
+
+void recoveryOnSend(uint8_t cam, const VISCACommand& command, TopicId topicId) {
+    if (cam >= NUM_CAMS) {
+        return;
+    }
+    // One entry per frame, each gets its own answer
+    uint8_t start = 0;
+    for (uint8_t i = 0; i < command.len; i++) {
+        if (command.payload[i] == 0xFF) {
+            addPending(recovery[cam], command.payload + start, i + 1 - start,
+                       topicId);
+            start = i + 1;
+        }
+    }
+}
+
+static void clearCamera(uint8_t cam) {
+    // Bypasses the quarantine, which it is there to lift
+    busEnqueue(cam, clearBuffer(cam), TOPIC_UNKNOWN, true);
+}
+
+static void probeCamera(uint8_t cam) {
+    clearCamera(cam);
+    busEnqueue(cam, powerInquiry(cam), TOPIC_UNKNOWN, true);
+    recovery[cam].lastProbe = millis();
+}
+
+static void countFault(uint8_t cam, uint8_t code, uint8_t socket) {
+    CameraRecovery& camera = recovery[cam];
+    const uint32_t now = millis();
+    if (now - camera.windowStart > RECOVERY_FAULT_WINDOW_MS) {
+        camera.windowStart = now;
+        camera.faults = 0;
+    }
+    if (++camera.faults < RECOVERY_CLEAR_AFTER) {
+        return;
+    }
+
+    camera.faults = 0;
+    camera.retries = 0;
+    camera.errors.clears++;
+    metrics.recoveryClears++;
+    clearCamera(cam);
+    report(cam, "clearBuffer", code, socket);
+
+    if (++camera.clearsWithoutSuccess >= RECOVERY_QUARANTINE_AFTER &&
+        !camera.errors.quarantined) {
+        camera.errors.quarantined = true;
+        // The first probe is the clear that was just sent
+        camera.lastProbe = now;
+        metrics.recoveryQuarantines++;
+        report(cam, "quarantined", code, socket);
+    }
+}
+
+// Sends the one frame the camera had no room for again
+static void retry(uint8_t cam, uint8_t socket, const PendingFrame& frame) {
+    CameraRecovery& camera = recovery[cam];
+    if (camera.retries >= RECOVERY_MAX_RETRIES) {
+        report(cam, "gaveUp", VISCA_ERROR_BUFFER_FULL, socket);
+        camera.retries = 0;
+        return;
+    }
+    uint32_t backoff = RECOVERY_BACKOFF_MS << camera.retries;
+    camera.retries++;
+    VISCACommand command;
+    command.len = frame.length;
+    memcpy(command.payload, frame.payload, frame.length);
+    if (scheduleCommand(command, cam, bridgeMillis() + backoff,
+                        (TopicId)frame.topicId)) {
+        camera.errors.retries++;
+        metrics.recoveryRetries++;
+    }
+}
+
+static void recovered(uint8_t cam) {
+    CameraRecovery& camera = recovery[cam];
+    camera.retries = 0;
+    camera.clearsWithoutSuccess = 0;
+    if (camera.errors.quarantined) {
+        camera.errors.quarantined = false;
+        report(cam, "recovered", 0, 0);
+    }
+}
+
+bool recoveryOnReply(uint8_t cam, const uint8_t* reply, int length) {
+    if (cam >= NUM_CAMS || length < 3) {
+        return false;
+    }
+    const uint8_t type = reply[1] & 0xf0;
+    const uint8_t socket = reply[1] & 0x0f;
+    CameraRecovery& camera = recovery[cam];
+
+    // Match the answer to the frame it belongs to. Completions and errors on
+    // a socket are for a frame that was ACKed already.
+    PendingFrame frame;
+    bool matched = false;
+    if (type == 0x40) {
+        matched = takePending(camera, PENDING_COMMAND, frame);
+    } else if (type == 0x60 &&
+               (socket == 0 || reply[2] == VISCA_ERROR_NO_SOCKET)) {
+        matched =
+            takePending(camera, PENDING_COMMAND | PENDING_INQUIRY, frame);
+    } else if (type == 0x50 && length > 3) {
+        matched = takePending(camera, PENDING_INQUIRY, frame);
+    } else if (type == 0x50 && socket == 0) {
+        matched = takePending(camera, PENDING_CLEAR, frame);
+    }
+    if (camera.errors.quarantined) {
+        // IF_Clear is answered with a bare completion even by a stuck
+        // camera. Only an ACK or the answer to the power inquiry, within a
+        // probe interval, shows it takes commands again.
+        const bool probeAnswer = type == 0x40 || (type == 0x50 && length > 3);
+        if (probeAnswer && millis() - camera.lastProbe <= RECOVERY_PROBE_MS) {
+            recovered(cam);
+            // The power inquiry was ours, nobody else waits for it
+            return type == 0x50;
+        }
+    } else if (type == 0x50 && length == 3 && socket != 0) {
+        // A command ran to completion. Not the ACK: "not executable" comes
+        // after one, and not socket 0: that is the IF_Clear answer.
+        recovered(cam);
+        return false;
+    }
+    if (type != 0x60 || length != 4) {
+        return false;
+    }
+
+    const uint8_t code = reply[2];
+    CameraErrors& errors = camera.errors;
+    errors.lastSocket = socket;
+    metrics.viscaErrors++;
+
+    switch (code) {
+        case VISCA_ERROR_LENGTH:
+            errors.length++;
+            report(cam, "length", code, socket);
+            countFault(cam, code, socket);
+            break;
+        case VISCA_ERROR_SYNTAX:
+            errors.syntax++;
+            report(cam, "syntax", code, socket);
+            countFault(cam, code, socket);
+            break;
+        case VISCA_ERROR_BUFFER_FULL:
+            errors.bufferFull++;
+            report(cam, "bufferFull", code, socket);
+            if (matched) {
+                retry(cam, socket, frame);
+            }
+            countFault(cam, code, socket);
+            break;
+        case VISCA_ERROR_CANCELLED:
+            // Answer to a cancel, nothing wrong with the camera
+            errors.cancelled++;
+            report(cam, "cancelled", code, socket);
+            break;
+        case VISCA_ERROR_NO_SOCKET:
+            errors.noSocket++;
+            report(cam, "noSocket", code, socket);
+            break;
+        case VISCA_ERROR_NOT_EXECUTABLE:
+            errors.notExecutable++;
+            report(cam, "notExecutable", code, socket);
+            countFault(cam, code, socket);
+            break;
+        default:
+            errors.other++;
+            report(cam, "unknown", code, socket);
+            break;
+    }
+    return true;
+}
+
+void serviceRecovery() {
+    const uint32_t now = millis();
+    for (uint8_t cam = 0; cam < NUM_CAMS; cam++) {
+        CameraRecovery& camera = recovery[cam];
+        if (camera.errors.quarantined &&
+            now - camera.lastProbe > RECOVERY_PROBE_MS) {
+            probeCamera(cam);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#include <Arduino.h>
+#pragma once
+#include <camera.h>
+#include <commands.h>
+#include <topics.h>
+
+// Error replies are y0 6z ee ff, z is the socket, ee one of these
+#define VISCA_ERROR_LENGTH 0x01
+#define VISCA_ERROR_SYNTAX 0x02
+#define VISCA_ERROR_BUFFER_FULL 0x03
+#define VISCA_ERROR_CANCELLED 0x04
+#define VISCA_ERROR_NO_SOCKET 0x05
+#define VISCA_ERROR_NOT_EXECUTABLE 0x41
+
+// Buffer full is retried with backoff 40, 80, 160 ms
+#define RECOVERY_MAX_RETRIES 3
+#define RECOVERY_BACKOFF_MS 40
+// Frames sent to a camera and not answered yet, oldest first. A frame the
+// camera has not answered within the timeout is taken as lost.
+#define RECOVERY_PENDING_FRAMES 8
+#define RECOVERY_PENDING_FRAME_LENGTH 16
+#define RECOVERY_ANSWER_TIMEOUT_MS 500
+// That many faults within the window clear the camera's command buffer
+#define RECOVERY_FAULT_WINDOW_MS 2000
+#define RECOVERY_CLEAR_AFTER 3
+// That many clears without a completed command in between take the camera
+// out of scheduling. It is probed with IF_Clear and a power inquiry until it
+// answers one of them with more than a bare completion.
+#define RECOVERY_QUARANTINE_AFTER 3
+#define RECOVERY_PROBE_MS 2000
+
+struct CameraErrors {
+    uint32_t length;
+    uint32_t syntax;
+    uint32_t bufferFull;
+    uint32_t cancelled;
+    uint32_t noSocket;
+    uint32_t notExecutable;
+    uint32_t other;
+    uint8_t lastSocket;
+    uint32_t retries;
+    uint32_t clears;
+    bool quarantined;
+};
+
+// Receives a JSON message for every decoded error and recovery action
+void setRecoveryCallback(void (*callback)(const char* message));
+
+bool cameraAvailable(uint8_t cam);
+void recoveryOnSend(uint8_t cam, const VISCACommand& command, TopicId topicId);
+bool recoveryOnReply(uint8_t cam, const uint8_t* reply, int length);
+const CameraErrors& cameraErrors(uint8_t cam);
+void serviceRecovery();
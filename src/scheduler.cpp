@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include <bus.h>
+#include <commands.h>
+#include <scheduler.h>
+
+
+struct ScheduledCommand {
+    uint32_t at;
+    uint16_t seq;
+    int8_t next;
+    uint8_t cam;
+    uint8_t topicId;
+    VISCACommand command;
+};
+
+static ScheduledCommand entries[SCHEDULER_MAX_ENTRIES];
+static int8_t wheel[SCHEDULER_SLOTS];
+static int8_t freeList = -1;
+static bool initialized = false;
+static uint16_t nextSeq = 0;
+static uint32_t lastTick = 0;
+static int32_t clockOffset = 0;
+
+static bool isDue(uint32_t at, uint32_t now) { return (int32_t)(at - now) <= 0; }
+
+static void initScheduler() {
+    for (uint8_t i = 0; i < SCHEDULER_SLOTS; i++) {
+        wheel[i] = -1;
+    }
+    for (uint8_t i = 0; i < SCHEDULER_MAX_ENTRIES; i++) {
+        entries[i].next = (i + 1 < SCHEDULER_MAX_ENTRIES) ? i + 1 : -1;
+    }
+    freeList = 0;
+    lastTick = bridgeMillis() / SCHEDULER_TICK_MS;
+    initialized = true;
+}
+
+/*Bridge clock*/
+uint32_t bridgeMillis() { return millis() + clockOffset; }
+
+void setBridgeTime(uint32_t now) {
+    // Pending entries keep their absolute target time. A jump forward is
+    // caught up by runScheduler(), a jump back just makes them wait longer.
+    clockOffset = (int32_t)(now - millis());
+}
+
+/*Timer wheel*/
+bool scheduleCommand(const VISCACommand& command, uint8_t cam, uint32_t at,
+                     TopicId topicId) {
+    if (!initialized) {
+        initScheduler();
+    }
+    if (freeList < 0) {
+        return false;
+    }
+    int8_t index = freeList;
+    freeList = entries[index].next;
+
+    ScheduledCommand& entry = entries[index];
+    entry.at = at;
+    entry.seq = nextSeq++;
+    entry.cam = cam;
+    entry.topicId = topicId;
+    entry.command = command;
+
+    uint8_t slot = (at / SCHEDULER_TICK_MS) % SCHEDULER_SLOTS;
+    entry.next = wheel[slot];
+    wheel[slot] = index;
+    return true;
+}
+
+static bool releasesBefore(const ScheduledCommand& a, const ScheduledCommand& b) {
+    if (a.at != b.at) {
+        return (int32_t)(a.at - b.at) < 0;
+    }
+    return (int16_t)(a.seq - b.seq) < 0;
+}
+
+bool runScheduler(ScheduleReport& report) {
+    if (!initialized) {
+        initScheduler();
+    }
+    const uint32_t now = bridgeMillis();
+    const uint32_t nowTick = now / SCHEDULER_TICK_MS;
+
+    uint32_t ticks = nowTick - lastTick + 1;
+    if ((int32_t)(nowTick - lastTick) < 0) {
+        ticks = 1;
+        lastTick = nowTick;
+    }
+    if (ticks > SCHEDULER_SLOTS) {
+        ticks = SCHEDULER_SLOTS;
+    }
+
+    // Collect everything that is due, so the frames can go out back to back
+    // instead of being interleaved with MQTT work.
+    int8_t batch[SCHEDULER_MAX_ENTRIES];
+    uint8_t batchSize = 0;
+    for (uint32_t t = 0; t < ticks; t++) {
+        uint8_t slot = (lastTick + t) % SCHEDULER_SLOTS;
+        int8_t* link = &wheel[slot];
+        while (*link >= 0) {
+            int8_t index = *link;
+            if (isDue(entries[index].at, now)) {
+                *link = entries[index].next;
+                uint8_t pos = batchSize++;
+                while (pos > 0 &&
+                       releasesBefore(entries[index], entries[batch[pos - 1]])) {
+                    batch[pos] = batch[pos - 1];
+                    pos--;
+                }
+                batch[pos] = index;
+            } else {
+                link = &entries[index].next;
+            }
+        }
+    }
+    lastTick = nowTick;
+
+    if (batchSize == 0) {
+        return false;
+    }
+
+    report.at = entries[batch[0]].at;
+    report.frames = batchSize;
+    report.lateMs = now - report.at;
+
+    uint32_t firstStart = micros();
+    uint32_t lastStart = firstStart;
+    for (uint8_t i = 0; i < batchSize; i++) {
+        ScheduledCommand& entry = entries[batch[i]];
+        lastStart = micros();
+        // Straight to the port, a bus queue would spread the batch out
+        busWrite(entry.cam, entry.command, (TopicId)entry.topicId);
+        entry.next = freeList;
+        freeList = batch[i];
+    }
+    report.skewUs = lastStart - firstStart;
+    return true;
+}
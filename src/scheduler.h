@@ -0,0 +1,25 @@
+#include <Arduino.h>
+#pragma once
+#include <commands.h>
+#include <topics.h>
+
+// The wheel turns one slot every SCHEDULER_TICK_MS, so one round covers
+// SCHEDULER_SLOTS * SCHEDULER_TICK_MS milliseconds. Commands further out
+// simply stay in their slot for another round.
+#define SCHEDULER_SLOTS 32
+#define SCHEDULER_TICK_MS 8
+#define SCHEDULER_MAX_ENTRIES 16
+
+struct ScheduleReport {
+    uint32_t at;       // target time of the released batch (bridge clock)
+    uint8_t frames;    // frames written back to back
+    uint32_t lateMs;   // how late the first frame left the bridge
+    uint32_t skewUs;   // start of first frame to start of last frame
+};
+
+uint32_t bridgeMillis();
+void setBridgeTime(uint32_t now);
+
+bool scheduleCommand(const VISCACommand& command, uint8_t cam, uint32_t at,
+                     TopicId topicId = TOPIC_UNKNOWN);
+bool runScheduler(ScheduleReport& report);
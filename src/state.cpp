@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include <bus.h>
+#include <commands.h>
+#include <metrics.h>
+#include <recovery.h>
+#include <state.h>
+
+// Inquiry replies carry no hint which inquiry they answer, they are matched
+// by order: pan/tilt, zoom, focus.
+enum Inquiry : uint8_t { INQUIRY_PANTILT, INQUIRY_ZOOM, INQUIRY_FOCUS, INQUIRY_DONE };
+
+struct StateWaiter {
+    uint32_t id;
+    CommandOrigin origin;
+};
+
+struct CameraState {
+    int pan;
+    int tilt;
+    int zoom;
+    int focus;
+    uint32_t updated;
+    bool valid;
+
+    bool inquiring;
+    uint8_t expected;
+    uint32_t inquirySent;
+    StateWaiter waiters[STATE_MAX_WAITERS];
+    uint8_t waiterCount;
+};
+
+static CameraState states[NUM_CAMS];
+static void (*stateCallback)(CommandOrigin origin,
+                             const char* message) = nullptr;
+
+void setStateCallback(void (*callback)(CommandOrigin origin,
+                                       const char* message)) {
+    stateCallback = callback;
+}
+
+static uint16_t nibbles(const uint8_t* data) {
+    return (data[0] & 0x0f) << 12 | (data[1] & 0x0f) << 8 |
+           (data[2] & 0x0f) << 4 | (data[3] & 0x0f);
+}
+
+static bool sameOrigin(CommandOrigin a, CommandOrigin b) {
+    return a.source == b.source && a.client == b.client;
+}
+
+// One message for the requester(s) behind origin, ids lists everyone there
+// who asked
+static void answer(uint8_t cam, CommandOrigin origin, const uint32_t* ids,
+                   uint8_t idCount, bool cached, const char* error) {
+    if (!stateCallback) {
+        return;
+    }
+    const CameraState& state = states[cam];
+    char message[256];
+    size_t used = snprintf(message, sizeof(message), "{\"cam\":%u,\"ids\":[",
+                           cam);
+    for (uint8_t i = 0; i < idCount && used < sizeof(message); i++) {
+        used += snprintf(message + used, sizeof(message) - used, "%s%lu",
+                         i ? "," : "", (unsigned long)ids[i]);
+    }
+    if (used < sizeof(message)) {
+        if (error) {
+            snprintf(message + used, sizeof(message) - used,
+                     "],\"error\":\"%s\"}", error);
+        } else {
+            snprintf(message + used, sizeof(message) - used,
+                     "],\"x\":%d,\"y\":%d,\"z\":%d,\"focus\":%d,"
+                     "\"age\":%lu,\"cached\":%s}",
+                     state.pan, state.tilt, state.zoom, state.focus,
+                     (unsigned long)(millis() - state.updated),
+                     cached ? "true" : "false");
+        }
+    }
+    stateCallback(origin, message);
+}
+
+static void finishInquiry(uint8_t cam, const char* error) {
+    CameraState& state = states[cam];
+    // Requesters that share a transport share a message
+    for (uint8_t i = 0; i < state.waiterCount; i++) {
+        const CommandOrigin origin = state.waiters[i].origin;
+        bool answered = false;
+        for (uint8_t j = 0; j < i && !answered; j++) {
+            answered = sameOrigin(state.waiters[j].origin, origin);
+        }
+        if (answered) {
+            continue;
+        }
+        uint32_t ids[STATE_MAX_WAITERS];
+        uint8_t idCount = 0;
+        for (uint8_t j = i; j < state.waiterCount; j++) {
+            if (sameOrigin(state.waiters[j].origin, origin)) {
+                ids[idCount++] = state.waiters[j].id;
+            }
+        }
+        answer(cam, origin, ids, idCount, false, error);
+    }
+    state.inquiring = false;
+    state.waiterCount = 0;
+}
+
+StateLookup requestState(uint8_t cam, uint32_t maxAge, uint32_t id,
+                         CommandOrigin origin) {
+    CameraState& state = states[cam];
+    metrics.stateRequests++;
+
+    if (state.valid && millis() - state.updated <= maxAge) {
+        metrics.stateHits++;
+        metrics.stateInquiriesSaved++;
+        answer(cam, origin, &id, 1, true, nullptr);
+        return STATE_HIT;
+    }
+
+    // Nobody is left without an answer: whoever cannot wait for the
+    // inquiry gets an error of their own
+    if (state.waiterCount >= STATE_MAX_WAITERS) {
+        answer(cam, origin, &id, 1, false, "too many requests");
+        return STATE_FAILED;
+    }
+    state.waiters[state.waiterCount++] = {id, origin};
+    if (state.inquiring) {
+        metrics.stateInquiriesSaved++;
+        return STATE_COALESCED;
+    }
+
+    if (!busEnqueue(cam, stateInquiry(cam))) {
+        finishInquiry(cam, cameraAvailable(cam) ? "bus busy" : "quarantined");
+        return STATE_FAILED;
+    }
+    metrics.stateInquiries++;
+    state.inquiring = true;
+    state.expected = INQUIRY_PANTILT;
+    state.inquirySent = millis();
+    return STATE_INQUIRY_SENT;
+}
+
+bool stateOnReply(uint8_t cam, const uint8_t* reply, int length) {
+    if (cam >= NUM_CAMS) {
+        return false;
+    }
+    CameraState& state = states[cam];
+    if (!state.inquiring || reply[1] != 0x50) {
+        return false;
+    }
+
+    if (state.expected == INQUIRY_PANTILT && length == 11) {
+        state.pan = nibbles(reply + 2);
+        state.tilt = nibbles(reply + 6);
+    } else if (state.expected == INQUIRY_ZOOM && length == 7) {
+        state.zoom = nibbles(reply + 2);
+    } else if (state.expected == INQUIRY_FOCUS && length == 7) {
+        state.focus = nibbles(reply + 2);
+    } else {
+        // A completion or something else, not ours
+        return false;
+    }
+
+    state.expected++;
+    if (state.expected == INQUIRY_DONE) {
+        state.valid = true;
+        state.updated = millis();
+        finishInquiry(cam, nullptr);
+    }
+    return true;
+}
+
+void serviceState() {
+    const uint32_t now = millis();
+    for (uint8_t cam = 0; cam < NUM_CAMS; cam++) {
+        CameraState& state = states[cam];
+        if (state.inquiring &&
+            now - state.inquirySent > STATE_INQUIRY_TIMEOUT_MS) {
+            finishInquiry(cam, "timeout");
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#include <Arduino.h>
+#pragma once
+#include <camera.h>
+#include <commands.h>
+
+// Cache of what the cameras actually report (as opposed to the PTZCam shadow,
+// which holds what we asked for). getState requests are answered from here
+// when fresh enough, otherwise all requesters share one inquiry.
+#define STATE_MAX_WAITERS 8
+#define STATE_INQUIRY_TIMEOUT_MS 500
+#define STATE_DEFAULT_MAX_AGE_MS 1000
+
+enum StateLookup : uint8_t {
+    STATE_HIT,           // answered from the cache right away
+    STATE_INQUIRY_SENT,  // first requester, inquiry queued on the bus
+    STATE_COALESCED,     // joined an inquiry already in flight
+    STATE_FAILED,        // answered with an error right away: camera
+                         // quarantined, bus queue full or too many waiting
+};
+
+// Receives every JSON answer and who it is for, main.cpp sends it back there
+// as return/camera/state
+void setStateCallback(void (*callback)(CommandOrigin origin,
+                                       const char* message));
+
+StateLookup requestState(uint8_t cam, uint32_t maxAge, uint32_t id,
+                         CommandOrigin origin);
+bool stateOnReply(uint8_t cam, const uint8_t* reply, int length);
+void serviceState();
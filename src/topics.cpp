@@ -0,0 +1,63 @@
+#include <Arduino.h>
+#include <topics.h>
+
+struct TopicEntry {
+    const char* name;
+    TopicId id;
+};
+
+static const TopicEntry topicTable[] = {
+    {"command/camera/raw", TOPIC_CAMERA_RAW},
+    {"command/camera/raw/0", TOPIC_CAMERA_RAW},
+    {"command/camera/raw/1", TOPIC_CAMERA_RAW_BUS1},
+    {"command/camera/raw/2", TOPIC_CAMERA_RAW_BUS2},
+    {"command/camera/blinkenlights", TOPIC_CAMERA_BLINKENLIGHTS},
+    {"command/camera/settings", TOPIC_CAMERA_SETTINGS},
+    {"command/camera/picture", TOPIC_CAMERA_PICTURE},
+    {"command/camera/moveto", TOPIC_CAMERA_MOVETO},
+    {"command/camera/moveby", TOPIC_CAMERA_MOVEBY},
+    {"command/camera/clearBuffer", TOPIC_CAMERA_CLEARBUFFER},
+    {"command/camera/setAddress", TOPIC_CAMERA_SETADDRESS},
+    {"command/camera/velocity", TOPIC_CAMERA_VELOCITY},
+    {"command/camera/velocityConfig", TOPIC_CAMERA_VELOCITYCONFIG},
+    {"command/camera/getState", TOPIC_CAMERA_GETSTATE},
+    {"command/camera/errors", TOPIC_CAMERA_ERRORS},
+    {"command/system/resetConfig", TOPIC_SYSTEM_RESETCONFIG},
+    {"command/system/updateConfig", TOPIC_SYSTEM_UPDATECONFIG},
+    {"command/system/getConfig", TOPIC_SYSTEM_GETCONFIG},
+    {"command/system/time", TOPIC_SYSTEM_TIME},
+    {"command/system/reboot", TOPIC_SYSTEM_REBOOT},
+    {"command/system/trace", TOPIC_SYSTEM_TRACE},
+    {"command/system/metrics", TOPIC_SYSTEM_METRICS},
+    {"command/system/macro/define", TOPIC_SYSTEM_MACRO_DEFINE},
+    {"command/system/macro/run", TOPIC_SYSTEM_MACRO_RUN},
+    {"command/system/macro/stop", TOPIC_SYSTEM_MACRO_STOP},
+    {"command/system/macro/delete", TOPIC_SYSTEM_MACRO_DELETE},
+};
+
+TopicId classifyTopic(const char* subTopic) {
+    for (const TopicEntry& entry : topicTable) {
+        if (strcmp(subTopic, entry.name) == 0) {
+            return entry.id;
+        }
+    }
+    return TOPIC_UNKNOWN;
+}
+
+bool cameraTopic(TopicId topicId) {
+    switch (topicId) {
+        case TOPIC_CAMERA_BLINKENLIGHTS:
+        case TOPIC_CAMERA_SETTINGS:
+        case TOPIC_CAMERA_PICTURE:
+        case TOPIC_CAMERA_MOVETO:
+        case TOPIC_CAMERA_MOVEBY:
+        case TOPIC_CAMERA_CLEARBUFFER:
+        case TOPIC_CAMERA_SETADDRESS:
+        case TOPIC_CAMERA_VELOCITY:
+        case TOPIC_CAMERA_GETSTATE:
+        case TOPIC_CAMERA_ERRORS:
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,37 @@
+#include <Arduino.h>
+#pragma once
+
+// Compact IDs for the subtopics below the base topic. They are stored in
+// trace records, so only ever append to this list.
+enum TopicId : uint8_t {
+    TOPIC_UNKNOWN = 0,
+    TOPIC_CAMERA_RAW,
+    TOPIC_CAMERA_BLINKENLIGHTS,
+    TOPIC_CAMERA_SETTINGS,
+    TOPIC_CAMERA_PICTURE,
+    TOPIC_CAMERA_MOVETO,
+    TOPIC_CAMERA_MOVEBY,
+    TOPIC_CAMERA_CLEARBUFFER,
+    TOPIC_CAMERA_SETADDRESS,
+    TOPIC_SYSTEM_RESETCONFIG,
+    TOPIC_SYSTEM_UPDATECONFIG,
+    TOPIC_SYSTEM_GETCONFIG,
+    TOPIC_SYSTEM_TIME,
+    TOPIC_SYSTEM_REBOOT,
+    TOPIC_SYSTEM_TRACE,
+    TOPIC_SYSTEM_METRICS,
+    TOPIC_CAMERA_VELOCITY,
+    TOPIC_CAMERA_VELOCITYCONFIG,
+    TOPIC_CAMERA_GETSTATE,
+    TOPIC_CAMERA_ERRORS,
+    TOPIC_SYSTEM_MACRO_DEFINE,
+    TOPIC_SYSTEM_MACRO_RUN,
+    TOPIC_SYSTEM_MACRO_STOP,
+    TOPIC_SYSTEM_MACRO_DELETE,
+    TOPIC_CAMERA_RAW_BUS1,  // raw frames for the second and third bus
+    TOPIC_CAMERA_RAW_BUS2,
+};
+
+TopicId classifyTopic(const char* subTopic);
+// Topics whose JSON names a camera with "cam"
+bool cameraTopic(TopicId topicId);
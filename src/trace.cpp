@@ -0,0 +1,54 @@
+#include <Arduino.h>
+#include <trace.h>
+
+static_assert(sizeof(TraceRecord) == 28, "trace dump layout changed");
+
+static TraceRecord records[TRACE_RECORDS];
+static uint16_t head = 0;
+static uint32_t written = 0;
+
+void traceRecord(uint8_t kind, uint8_t cam, uint8_t topic, uint8_t outcome,
+                 const uint8_t* data, unsigned int len) {
+    TraceRecord& record = records[head];
+    head = (head + 1) % TRACE_RECORDS;
+    written++;
+
+    record.time = millis();
+    record.kind = kind;
+    record.cam = cam;
+    record.topic = topic;
+    record.outcome = outcome;
+    record.len = len > 0xff ? 0xff : len;
+    uint8_t stored = len > TRACE_FRAME_BYTES ? TRACE_FRAME_BYTES : len;
+    memcpy(record.data, data, stored);
+    memset(record.data + stored, 0, TRACE_FRAME_BYTES - stored);
+}
+
+static uint16_t storedRecords() {
+    return written < TRACE_RECORDS ? written : TRACE_RECORDS;
+}
+
+size_t traceDumpSize() { return 16 + storedRecords() * sizeof(TraceRecord); }
+
+/*
+Dump layout, little endian:
+  "VTRC" | version u8 | record size u8 | record count u16 |
+  millis() at dump u32 | records written since boot u32 |
+  records, oldest first
+*/
+void traceDump(Print& out) {
+    const uint16_t count = storedRecords();
+    const uint32_t now = millis();
+    uint8_t header[16] = {'V', 'T', 'R', 'C', TRACE_VERSION,
+                          sizeof(TraceRecord)};
+    memcpy(header + 6, &count, sizeof(count));
+    memcpy(header + 8, &now, sizeof(now));
+    memcpy(header + 12, &written, sizeof(written));
+    out.write(header, sizeof(header));
+
+    uint16_t index = (head + TRACE_RECORDS - count) % TRACE_RECORDS;
+    for (uint16_t i = 0; i < count; i++) {
+        out.write((const uint8_t*)&records[index], sizeof(TraceRecord));
+        index = (index + 1) % TRACE_RECORDS;
+    }
+}
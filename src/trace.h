@@ -0,0 +1,39 @@
+#include <Arduino.h>
+#pragma once
+
+// Flight recorder for VISCA frames and MQTT events. Records are fixed size
+// and land in a ring buffer, so recording is a copy and nothing else.
+#define TRACE_RECORDS 128
+#define TRACE_FRAME_BYTES 19
+#define TRACE_VERSION 1
+
+enum TraceKind : uint8_t {
+    TRACE_TX = 0,    // frame written to the VISCA bus
+    TRACE_RX = 1,    // frame received from the VISCA bus
+    TRACE_MQTT = 2,  // MQTT message handled by callback()
+    TRACE_WEBSOCKET = 3,  // command from a WebSocket client
+    TRACE_CONSOLE = 4,    // command from the USB serial console
+};
+
+enum TraceOutcome : uint8_t {
+    TRACE_OK = 0,
+    TRACE_SCHEDULED = 1,
+    TRACE_DROPPED = 2,
+    TRACE_UNKNOWN_TOPIC = 3,
+    TRACE_BAD_JSON = 4,
+};
+
+struct TraceRecord {
+    uint32_t time;  // millis() when recorded
+    uint8_t kind;
+    uint8_t cam;
+    uint8_t topic;  // TopicId
+    uint8_t outcome;
+    uint8_t len;    // full frame length, data holds the first bytes
+    uint8_t data[TRACE_FRAME_BYTES];
+};
+
+void traceRecord(uint8_t kind, uint8_t cam, uint8_t topic, uint8_t outcome,
+                 const uint8_t* data, unsigned int len);
+size_t traceDumpSize();
+void traceDump(Print& out);
@@ -0,0 +1,46 @@
+#include <Arduino.h>
+#include <velocity.h>
+
+VelocityConfig velocityConfig = {5, 40, 15};
+
+static byte speedTable[VELOCITY_ZOOM_STEPS][VELOCITY_INPUT_MAX + 1];
+static bool tableReady = false;
+
+static void buildTable() {
+    const float deadzone = velocityConfig.deadzone;
+    const float expo = velocityConfig.expo / 100.0f;
+    const float tele = velocityConfig.teleScale / 100.0f;
+
+    for (uint8_t step = 0; step < VELOCITY_ZOOM_STEPS; step++) {
+        // Linear from full speed at wide to teleScale at full tele
+        float scale = 1.0f - (1.0f - tele) * step / (VELOCITY_ZOOM_STEPS - 1);
+        for (uint8_t input = 0; input <= VELOCITY_INPUT_MAX; input++) {
+            if (input <= deadzone) {
+                speedTable[step][input] = 0;
+                continue;
+            }
+            float travel = (input - deadzone) / (VELOCITY_INPUT_MAX - deadzone);
+            float curved = (1.0f - expo) * travel + expo * travel * travel * travel;
+            int speed = (int)(curved * scale * VELOCITY_MAX_SPEED + 0.5f);
+            // Outside the deadzone the camera always moves at least a bit
+            speedTable[step][input] = constrain(speed, 1, VELOCITY_MAX_SPEED);
+        }
+    }
+    tableReady = true;
+}
+
+void setVelocityConfig(const VelocityConfig& config) {
+    velocityConfig.deadzone = constrain(config.deadzone, 0, VELOCITY_INPUT_MAX - 1);
+    velocityConfig.expo = constrain(config.expo, 0, 100);
+    velocityConfig.teleScale = constrain(config.teleScale, 1, 100);
+    buildTable();
+}
+
+byte velocitySpeed(int input, int zoom) {
+    if (!tableReady) {
+        buildTable();
+    }
+    int magnitude = constrain(abs(input), 0, VELOCITY_INPUT_MAX);
+    int step = constrain(zoom, 0, MAXZ) * VELOCITY_ZOOM_STEPS / (MAXZ + 1);
+    return speedTable[step][magnitude];
+}
@@ -0,0 +1,20 @@
+#include <Arduino.h>
+#pragma once
+#include <camera.h>
+
+// Joystick input is -100..100 per axis. The speed for every input magnitude
+// and zoom step is precomputed, a message only does a table lookup.
+#define VELOCITY_INPUT_MAX 100
+#define VELOCITY_ZOOM_STEPS 8
+#define VELOCITY_MAX_SPEED 0x1f
+
+struct VelocityConfig {
+    uint8_t deadzone;   // stick travel ignored around center, 0-99
+    uint8_t expo;       // 0 linear, 100 fully cubic
+    uint8_t teleScale;  // percent of full speed left at full tele, 1-100
+};
+
+extern VelocityConfig velocityConfig;
+
+void setVelocityConfig(const VelocityConfig& config);
+byte velocitySpeed(int input, int zoom);
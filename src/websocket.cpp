@@ -0,0 +1,173 @@
+#include <Arduino.h>
+#include <WebSocketsServer.h>
+#include <camera.h>
+#include <commands.h>
+#include <metrics.h>
+#include <topics.h>
+#include <trace.h>
+#include <websocket.h>
+
+static_assert(NUM_CAMS <= 32, "pending cameras are kept in a uint32_t");
+
+struct WebSocketClient {
+    bool connected;
+    uint32_t pending;  // cameras whose state this client has not seen yet
+    uint32_t lastPush;
+};
+
+// sendTXT() writes synchronously, and with the client's TCP send buffer full
+// it spins until WEBSOCKETS_TCP_TIMEOUT (5 s). Asking the socket first keeps
+// one stalled client from stopping the bridge.
+class BridgeWebSocketsServer : public WebSocketsServer {
+   public:
+    using WebSocketsServer::WebSocketsServer;
+    bool fits(uint8_t num, size_t length) {
+        WiFiClient* tcp = _clients[num].tcp;
+        // Server frames are unmasked: 2 header bytes, 4 from 126 bytes on
+        const size_t header = length < 126 ? 2 : 4;
+        return tcp && (size_t)tcp->availableForWrite() >= length + header;
+    }
+};
+
+static BridgeWebSocketsServer webSocket(WEBSOCKET_PORT);
+static WebSocketClient clients[WEBSOCKETS_SERVER_CLIENT_MAX];
+static uint16_t seenVersion[NUM_CAMS];
+
+static bool sendText(uint8_t num, const char* message, size_t length = 0) {
+    if (length == 0) {
+        length = strlen(message);
+    }
+    if (!webSocket.fits(num, length)) {
+        metrics.webSocketBackpressure++;
+        return false;
+    }
+    beginNetworkCall();
+    bool sent = webSocket.sendTXT(num, message, length);
+    endNetworkCall();
+    return sent;
+}
+
+void webSocketReply(uint8_t num, const char* subTopic, const char* message) {
+    // static, metrics alone are close to 1 KB
+    static char text[WEBSOCKET_REPLY_LENGTH];
+    int length = snprintf(text, sizeof(text), "%s %s", subTopic, message);
+    if (length > 0 && (size_t)length < sizeof(text)) {
+        sendText(num, text, length);
+    }
+}
+
+static bool adminTopic(TopicId topicId) {
+    return topicId == TOPIC_SYSTEM_RESETCONFIG ||
+           topicId == TOPIC_SYSTEM_UPDATECONFIG ||
+           topicId == TOPIC_SYSTEM_GETCONFIG || topicId == TOPIC_SYSTEM_REBOOT;
+}
+
+static void handleCommand(uint8_t num, TopicId topicId, uint8_t* payload,
+                          size_t length) {
+    if (adminTopic(topicId)) {
+        traceRecord(TRACE_WEBSOCKET, 0, topicId, TRACE_DROPPED, payload,
+                    length);
+        sendText(num, "not allowed over WebSocket, use MQTT or the console");
+        return;
+    }
+    dispatchCommand(topicId, payload, length, {TRACE_WEBSOCKET, num});
+}
+
+static void handleText(uint8_t num, uint8_t* payload, size_t length) {
+    // "<topic> <json>", the topic is the same as below the MQTT base topic
+    size_t split = 0;
+    while (split < length && payload[split] != ' ') {
+        split++;
+    }
+    if (split == length) {
+        sendText(num, "expected \"<topic> <json>\"");
+        return;
+    }
+    payload[split] = '\0';
+    TopicId topicId = classifyTopic((const char*)payload);
+    if (topicId == TOPIC_UNKNOWN) {
+        sendText(num, "unknown topic");
+    }
+    handleCommand(num, topicId, payload + split + 1, length - split - 1);
+}
+
+static void handleEvent(uint8_t num, WStype_t type, uint8_t* payload,
+                        size_t length) {
+    if (num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+        return;
+    }
+    switch (type) {
+        case WStype_CONNECTED:
+            clients[num].connected = true;
+            clients[num].pending = (1ULL << NUM_CAMS) - 1;
+            clients[num].lastPush = 0;
+            break;
+        case WStype_DISCONNECTED:
+            clients[num].connected = false;
+            break;
+        case WStype_TEXT:
+            metrics.webSocketCommands++;
+            handleText(num, payload, length);
+            break;
+        case WStype_BIN:
+            metrics.webSocketCommands++;
+            if (length > 0) {
+                handleCommand(num, (TopicId)payload[0], payload + 1,
+                              length - 1);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void beginWebSocket() {
+    webSocket.onEvent(handleEvent);
+    webSocket.begin();
+}
+
+static bool pushState(uint8_t num, uint8_t cam) {
+    char message[80];
+    int length = snprintf(message, sizeof(message),
+                          "{\"cam\":%u,\"x\":%d,\"y\":%d,\"z\":%d,\"focus\":%d}",
+                          cam, cams[cam].getX(), cams[cam].getY(),
+                          cams[cam].getZ(), cams[cam].getFocus());
+    return sendText(num, message, length);
+}
+
+void serviceWebSocket() {
+    webSocket.loop();
+
+    // Coalescing: a camera only has a pending bit, however often it changed
+    // since the last push the client gets its current state once.
+    for (uint8_t cam = 0; cam < NUM_CAMS; cam++) {
+        uint16_t version = cams[cam].getVersion();
+        if (version == seenVersion[cam]) {
+            continue;
+        }
+        seenVersion[cam] = version;
+        for (WebSocketClient& client : clients) {
+            client.pending |= 1UL << cam;
+        }
+    }
+
+    // Backpressure: at most one push per client and interval, and a push the
+    // client could not take stays pending instead of piling up.
+    const uint32_t now = millis();
+    for (uint8_t num = 0; num < WEBSOCKETS_SERVER_CLIENT_MAX; num++) {
+        WebSocketClient& client = clients[num];
+        if (!client.connected || client.pending == 0 ||
+            now - client.lastPush < WEBSOCKET_PUSH_INTERVAL_MS) {
+            continue;
+        }
+        uint8_t cam = 0;
+        while (!(client.pending & (1UL << cam))) {
+            cam++;
+        }
+        client.lastPush = now;
+        if (pushState(num, cam)) {
+            client.pending &= ~(1UL << cam);
+            metrics.webSocketPushes++;
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#include <Arduino.h>
+#pragma once
+
+// Local control surface on ws://<bridge>:81/, no broker in between.
+//   text:   "command/camera/moveto {\"x\": 400, \"cam\": 1}"
+//   binary: one TopicId byte, then the payload as it would go over MQTT
+// Answers to a client's commands come back to that client in the same text
+// format, e.g. "return/system/time {\"time\":118000}".
+// Clients get the PTZCam shadow state of every camera pushed as JSON, one
+// camera per push, only for cameras that changed.
+// Topics that rewrite or erase the configuration, show it or restart the
+// bridge are refused: anyone on the LAN can open the socket.
+#define WEBSOCKET_PORT 81
+#define WEBSOCKET_PUSH_INTERVAL_MS 20
+#define WEBSOCKET_REPLY_LENGTH 1024
+
+void beginWebSocket();
+void serviceWebSocket();
+void webSocketReply(uint8_t num, const char* subTopic, const char* message);
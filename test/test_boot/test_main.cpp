@@ -0,0 +1,139 @@
+// Boot with the saved network missing and the broker down: setup() and every
+// loop() pass stay short, the USB console answers from the start, and the
+// config portal only opens once the saved network had its chance.
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <WiFiManager.h>
+#include <bus.h>
+#include <host_visca.h>
+#include <metrics.h>
+#include <unity.h>
+
+extern PubSubClient client;
+extern WiFiManager wifiManager;
+void setup();
+void loop();
+
+static unsigned long setupMs;
+
+// Runs loop() for ms of simulated time, returns the longest pass
+static unsigned long runFor(unsigned long ms) {
+    unsigned long longest = 0;
+    const unsigned long start = millis();
+    while (millis() - start < ms) {
+        const unsigned long before = millis();
+        loop();
+        longest = max(longest, millis() - before);
+        hostAdvanceMs(10);
+    }
+    return longest;
+}
+static void console(const char* line) {
+    Serial.hostClear();
+    Serial.hostInput(line);
+    loop();
+}
+
+void test_setup_does_not_wait_for_wifi() {
+    TEST_ASSERT_LESS_THAN(100, setupMs);
+    TEST_ASSERT_EQUAL(0, wifiManager.hostAutoConnectCalls);
+    TEST_ASSERT_EQUAL(1, WiFi.hostBeginCalls);
+    TEST_ASSERT_FALSE(wifiManager.hostPortalActive);
+}
+void test_console_answers_right_away() {
+    console("command/system/time {}\n");
+    TEST_ASSERT_NOT_NULL(strstr(Serial.hostOutput(),
+                                "return/system/time {\"time\":"));
+    TEST_ASSERT_NOT_NULL(strstr(Serial.hostOutput(), "ok\r\n"));
+
+    // No payload is the same as {}
+    console("command/system/metrics\n");
+    TEST_ASSERT_NOT_NULL(strstr(Serial.hostOutput(), "return/system/metrics {"));
+
+    hostChain().hostClear();
+    console("command/camera/moveto {\"x\":400,\"cam\":1}\n");
+    TEST_ASSERT_EQUAL_STRING("ok\r\n", Serial.hostOutput());
+    serviceBuses();
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+}
+void test_console_reports_bad_json() {
+    hostChain().hostClear();
+    console("command/camera/moveto {\"x\":400,\n");
+    TEST_ASSERT_EQUAL_STRING(
+        "return/system Bad JSON, command dropped: IncompleteInput\r\n"
+        "error: bad json\r\n",
+        Serial.hostOutput());
+    console("command/camera/settings flip\n");
+    TEST_ASSERT_NOT_NULL(strstr(Serial.hostOutput(), "error: bad json\r\n"));
+    serviceBuses();
+    TEST_ASSERT_EQUAL(0, hostChain().hostWrites());
+
+    console("command/nothing {}\n");
+    TEST_ASSERT_EQUAL_STRING("error: unknown topic\r\n", Serial.hostOutput());
+}
+void test_console_rejects_unknown_cameras() {
+    hostChain().hostClear();
+    const int x = cams[0].getX();
+    // Cameras 0 to 6 on the default chain
+    console("command/camera/moveto {\"x\":10,\"cam\":7}\n");
+    TEST_ASSERT_NOT_NULL(strstr(Serial.hostOutput(),
+                                "return/system No such camera"));
+    TEST_ASSERT_NOT_NULL(strstr(Serial.hostOutput(), "error: dropped\r\n"));
+    serviceBuses();
+    TEST_ASSERT_EQUAL(0, hostChain().hostWrites());
+    TEST_ASSERT_EQUAL(x, cams[0].getX());
+}
+void test_portal_opens_after_the_connect_timeout() {
+    const unsigned long longest = runFor(15000 - millis());
+    TEST_ASSERT_FALSE(wifiManager.hostPortalActive);
+    TEST_ASSERT_LESS_THAN(20, longest);
+    runFor(10000);
+    TEST_ASSERT_TRUE(wifiManager.hostPortalActive);
+}
+void test_portal_closes_when_the_network_turns_up() {
+    WiFi.hostStatus = WL_CONNECTED;
+    loop();
+    TEST_ASSERT_FALSE(wifiManager.hostPortalActive);
+}
+void test_broker_down_costs_a_short_timeout() {
+    client.hostBrokerReachable = false;
+    const int attempts = client.hostConnectAttempts;
+    const unsigned long longest = runFor(20000);
+    // One attempt every 5 s, each blocking for the short connect timeout
+    TEST_ASSERT_INT_WITHIN(1, attempts + 4, client.hostConnectAttempts);
+    TEST_ASSERT_LESS_OR_EQUAL(300, longest);
+
+    client.hostBrokerReachable = true;
+    runFor(6000);
+    TEST_ASSERT_TRUE(client.connected());
+}
+void test_bad_json_over_mqtt_is_answered() {
+    const uint32_t parses = metrics.jsonParses;
+    client.hostDeliver("VISCA/command/camera/moveto", "{\"x\":400,");
+    TEST_ASSERT_EQUAL_UINT32(parses + 1, metrics.jsonParses);
+    const PubSubClient::Message* message = client.hostLast("return/system");
+    TEST_ASSERT_NOT_NULL(message);
+    TEST_ASSERT_EQUAL_STRING("Bad JSON, command dropped: IncompleteInput",
+                             (const char*)message->payload);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    // A network is saved, it just is not there
+    WiFi.hostStatus = WL_DISCONNECTED;
+    const unsigned long start = millis();
+    setup();
+    setupMs = millis() - start;
+    UNITY_BEGIN();
+    RUN_TEST(test_setup_does_not_wait_for_wifi);
+    RUN_TEST(test_console_answers_right_away);
+    RUN_TEST(test_console_reports_bad_json);
+    RUN_TEST(test_console_rejects_unknown_cameras);
+    RUN_TEST(test_portal_opens_after_the_connect_timeout);
+    RUN_TEST(test_portal_closes_when_the_network_turns_up);
+    RUN_TEST(test_broker_down_costs_a_short_timeout);
+    RUN_TEST(test_bad_json_over_mqtt_is_answered);
+    return UNITY_END();
+}
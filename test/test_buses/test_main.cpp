@@ -0,0 +1,219 @@
+// Three chains of three cameras (env:native_buses): routing of commands,
+// replies and raw frames per bus, dropped commands being reported, and how
+// much a second and third chain add to throughput.
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <bus.h>
+#include <host_visca.h>
+#include <metrics.h>
+#include <trace.h>
+#include <unity.h>
+
+static_assert(VISCA_BUSES == 3 && VISCA_CAMS_PER_BUS == 3,
+              "run with pio test -e native_buses");
+
+extern PubSubClient client;
+void setup();
+void loop();
+
+static void deliver(const char* subTopic, const char* payload) {
+    char topic[HOST_MQTT_TOPIC];
+    snprintf(topic, sizeof(topic), "VISCA/%s", subTopic);
+    client.hostDeliver(topic, payload);
+}
+static const char* lastPublished(const char* subTopic) {
+    const PubSubClient::Message* message = client.hostLast(subTopic);
+    return message ? (const char*)message->payload : "";
+}
+static void drain() {
+    for (uint8_t i = 0; i < VISCA_BUS_QUEUE + 1; i++) {
+        serviceBuses();
+    }
+}
+
+// Camera of the newest RX record in the flight recorder
+static int lastReplyCam() {
+    TraceRecord record;
+    return hostLastTrace(TRACE_RX, record) ? record.cam : -1;
+}
+
+void test_camera_mapping() {
+    TEST_ASSERT_EQUAL(9, NUM_CAMS);
+    const uint8_t expectedBus[NUM_CAMS] = {0, 0, 0, 1, 1, 1, 2, 2, 2};
+    const uint8_t expectedAddress[NUM_CAMS] = {1, 2, 3, 1, 2, 3, 1, 2, 3};
+    for (uint8_t cam = 0; cam < NUM_CAMS; cam++) {
+        TEST_ASSERT_EQUAL(expectedBus[cam], cameraBus(cam));
+        TEST_ASSERT_EQUAL(expectedAddress[cam], cameraAddress(cam));
+        TEST_ASSERT_EQUAL_HEX8(0x80 + expectedAddress[cam],
+                               flip(true, cam).payload[0]);
+    }
+    TEST_ASSERT_TRUE(static_cast<HardwareSerial*>(buses[2].port)->swapped);
+}
+void test_commands_go_to_their_bus() {
+    deliver("command/camera/moveby", "{\"x\":20,\"cam\":4}");
+    deliver("command/camera/settings", "{\"flip\":true,\"cam\":6}");
+    drain();
+    TEST_ASSERT_EQUAL(0, hostChain(0).hostWrites());
+    TEST_ASSERT_EQUAL(1, hostChain(1).hostWrites());
+    TEST_ASSERT_EQUAL_HEX8(0x82, hostChain(1).hostBytes()[0]);
+    TEST_ASSERT_EQUAL(1, hostChain(2).hostWrites());
+    TEST_ASSERT_EQUAL_HEX8(0x81, hostChain(2).hostBytes()[0]);
+}
+void test_replies_on_every_bus() {
+    const uint8_t fromAddress2[] = {0xA0, 0x41, 0xFF};
+    hostChain(1).hostInput(fromAddress2, sizeof(fromAddress2));
+    serviceBuses();
+    TEST_ASSERT_EQUAL(4, lastReplyCam());
+    const uint8_t fromAddress1[] = {0x90, 0x41, 0xFF};
+    hostChain(2).hostInput(fromAddress1, sizeof(fromAddress1));
+    serviceBuses();
+    TEST_ASSERT_EQUAL(6, lastReplyCam());
+}
+void test_replies_past_the_chain_are_dropped() {
+    const uint32_t before = metrics.replies;
+    // Address 5 does not exist on a chain of 3
+    const uint8_t address5[] = {0xD0, 0x41, 0xFF};
+    hostChain(0).hostInput(address5, sizeof(address5));
+    serviceBuses();
+    TEST_ASSERT_EQUAL_UINT32(before, metrics.replies);
+    // Address 3 on bus 2 is the last camera
+    const uint8_t address3[] = {0xB0, 0x41, 0xFF};
+    hostChain(2).hostInput(address3, sizeof(address3));
+    serviceBuses();
+    TEST_ASSERT_EQUAL_UINT32(before + 1, metrics.replies);
+    TEST_ASSERT_EQUAL(8, lastReplyCam());
+}
+void test_cameras_past_the_last_are_dropped() {
+    const PTZCam before = cams[0];
+    const char* commands[] = {
+        "{\"x\":10,\"cam\":9}",
+        "{\"x\":10,\"cam\":255}",
+        "{\"x\":10,\"cam\":300}",
+        "{\"x\":10,\"cam\":-1}",
+    };
+    for (const char* command : commands) {
+        const uint32_t publishes = client.hostPublishes();
+        deliver("command/camera/moveto", command);
+        TEST_ASSERT_EQUAL_UINT32(publishes + 1, client.hostPublishes());
+        TEST_ASSERT_EQUAL_STRING("No such camera, command dropped",
+                                 lastPublished("return/system"));
+    }
+    deliver("command/camera/getState", "{\"cam\":9}");
+    drain();
+    for (uint8_t bus = 0; bus < VISCA_BUSES; bus++) {
+        TEST_ASSERT_EQUAL(0, hostChain(bus).hostWrites());
+    }
+    TEST_ASSERT_EQUAL(before.getX(), cams[0].getX());
+    TEST_ASSERT_FALSE(busEnqueue(NUM_CAMS, clearBuffer(0)));
+
+    // The last two cameras have their own shadow state
+    deliver("command/camera/moveto", "{\"x\":100,\"cam\":7}");
+    deliver("command/camera/moveto", "{\"x\":200,\"cam\":8}");
+    drain();
+    TEST_ASSERT_EQUAL(100, cams[7].getX());
+    TEST_ASSERT_EQUAL(200, cams[8].getX());
+    TEST_ASSERT_EQUAL(before.getX(), cams[0].getX());
+    TEST_ASSERT_EQUAL_HEX8(0x82, hostChain(2).hostBytes()[0]);
+}
+void test_raw_bus_selector() {
+    const uint8_t frame[] = {0x81, 0x01, 0x00, 0x01, 0xFF};
+    const char* topics[] = {"VISCA/command/camera/raw",
+                            "VISCA/command/camera/raw/1",
+                            "VISCA/command/camera/raw/2"};
+    for (uint8_t bus = 0; bus < VISCA_BUSES; bus++) {
+        client.hostDeliver(topics[bus], frame, sizeof(frame));
+        for (uint8_t other = 0; other < VISCA_BUSES; other++) {
+            TEST_ASSERT_EQUAL(other == bus ? sizeof(frame) : 0,
+                              hostChain(other).hostLength());
+        }
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(frame, hostChain(bus).hostBytes(),
+                                     sizeof(frame));
+        TEST_ASSERT_EQUAL_STRING("Kotze Daten 5",
+                                 lastPublished("return/camera/status"));
+        hostChain(bus).hostClear();
+    }
+    client.hostDeliver("VISCA/command/camera/raw/0", frame, sizeof(frame));
+    TEST_ASSERT_EQUAL(sizeof(frame), hostChain(0).hostLength());
+}
+void test_queue_full_is_reported() {
+    const uint32_t before = metrics.busQueueFull;
+    const uint32_t publishes = client.hostPublishes();
+    for (uint8_t i = 0; i < VISCA_BUS_QUEUE; i++) {
+        deliver("command/camera/settings", "{\"flip\":true,\"cam\":1}");
+    }
+    TEST_ASSERT_EQUAL_UINT32(publishes, client.hostPublishes());
+    deliver("command/camera/settings", "{\"flip\":true,\"cam\":1}");
+    TEST_ASSERT_EQUAL_UINT32(before + 1, metrics.busQueueFull);
+    TEST_ASSERT_EQUAL_STRING("Bus queue full, command dropped",
+                             lastPublished("return/system"));
+    // The other chains still take commands
+    deliver("command/camera/settings", "{\"flip\":true,\"cam\":3}");
+    TEST_ASSERT_EQUAL_UINT32(before + 1, metrics.busQueueFull);
+    drain();
+}
+
+// Sends frames to cams round robin as fast as the bus queues take them and
+// returns frames per second of simulated time
+static double framesPerSecond(const uint8_t* cams, uint8_t camCount,
+                              uint16_t frames) {
+    const uint32_t sentBefore = metrics.busFramesSent;
+    const unsigned long start = micros();
+    uint16_t queued = 0;
+    while (metrics.busFramesSent - sentBefore < frames) {
+        while (queued < frames) {
+            const uint8_t cam = cams[queued % camCount];
+            if (buses[cameraBus(cam)].queueCount >= VISCA_BUS_QUEUE ||
+                !busEnqueue(cam, relativeMovement(30, 0, cam))) {
+                break;
+            }
+            queued++;
+        }
+        serviceBuses();
+    }
+    // Until the UART is through with its FIFO as well
+    const unsigned long end =
+        max((unsigned long)micros(), hostChain(2).hostBusyUntilUs());
+    return frames * 1e6 / (end - start);
+}
+void test_benchmark_multi_chain_throughput() {
+    const uint8_t oneChain[] = {0, 1, 2};
+    const uint8_t threeChains[] = {0, 3, 6};
+    const double single = framesPerSecond(oneChain, 3, 300);
+    const double spread = framesPerSecond(threeChains, 3, 300);
+
+    char message[128];
+    snprintf(message, sizeof(message),
+             "1 chain %.1f frames/s, 3 chains %.1f frames/s (%.2fx)", single,
+             spread, spread / single);
+    TEST_MESSAGE(message);
+    // Bit-banged SoftwareSerial keeps the CPU for the whole frame, so the two
+    // SoftwareSerial chains take turns and only the UART sends alongside:
+    // 3 frames in the time of 2, not 3.
+    TEST_ASSERT_TRUE(spread > 1.4 * single);
+    TEST_ASSERT_TRUE(spread < 1.6 * single);
+}
+
+void setUp() {
+    for (uint8_t bus = 0; bus < VISCA_BUSES; bus++) {
+        hostChain(bus).hostClear();
+    }
+}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    WiFi.hostStatus = WL_CONNECTED;
+    setup();
+    for (uint8_t i = 0; i < 10 && !client.connected(); i++) {
+        loop();
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_camera_mapping);
+    RUN_TEST(test_commands_go_to_their_bus);
+    RUN_TEST(test_replies_on_every_bus);
+    RUN_TEST(test_replies_past_the_chain_are_dropped);
+    RUN_TEST(test_cameras_past_the_last_are_dropped);
+    RUN_TEST(test_raw_bus_selector);
+    RUN_TEST(test_queue_full_is_reported);
+    RUN_TEST(test_benchmark_multi_chain_throughput);
+    return UNITY_END();
+}
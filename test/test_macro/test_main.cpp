@@ -0,0 +1,199 @@
+// Macro engine on a simulated chain: define, store and run, waits and
+// completion gates, and redefinitions that fail leaving the old version.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <bus.h>
+#include <commands.h>
+#include <host_visca.h>
+#include <macro.h>
+#include <metrics.h>
+#include <unity.h>
+
+static char lastReport[128];
+
+static void collect(const char* message) {
+    strlcpy(lastReport, message, sizeof(lastReport));
+}
+static bool define(const char* json) {
+    return defineMacro((const byte*)json, strlen(json));
+}
+// serviceMacros() and the bus, as loop() runs them
+static void step() {
+    serviceMacros();
+    serviceBuses();
+}
+static void assertFrame(uint16_t n, const VISCACommand& expected) {
+    TEST_ASSERT_GREATER_THAN(n, hostChain().hostWrites());
+    const HostSerialPort::Write& write = hostChain().hostWrite(n);
+    TEST_ASSERT_EQUAL(expected.len, write.length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.payload,
+                                 hostChain().hostBytes() + write.offset,
+                                 expected.len);
+}
+static void readFile(const char* path, uint8_t* data, size_t& size) {
+    File file = LittleFS.open(path, "r");
+    TEST_ASSERT_TRUE(file);
+    size = file.read(data, file.size());
+    file.close();
+}
+
+void test_round_trip() {
+    TEST_ASSERT_TRUE(define(
+        "{\"name\":\"opening\",\"steps\":["
+        "{\"topic\":\"command/camera/moveto\",\"x\":400,\"y\":100,\"cam\":0},"
+        "{\"wait\":100},"
+        "{\"topic\":\"command/camera/settings\",\"flip\":true,\"cam\":1}]}"));
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"opening\",\"state\":\"defined\",\"step\":0,\"steps\":3}",
+        lastReport);
+    uint8_t code[MACRO_MAX_SIZE];
+    size_t size;
+    readFile("/macros/opening.vmc", code, size);
+    TEST_ASSERT_EQUAL_MEMORY("VMC", code, 3);
+    TEST_ASSERT_EQUAL(MACRO_VERSION, code[3]);
+    TEST_ASSERT_EQUAL(3, code[4]);
+    TEST_ASSERT_EQUAL(OP_END, code[size - 1]);
+
+    TEST_ASSERT_TRUE(runMacro("opening"));
+    step();
+    // The moveto went out and the shadow follows it
+    TEST_ASSERT_GREATER_THAN(0, hostChain().hostWrites());
+    const uint16_t moveFrames = hostChain().hostWrites();
+    TEST_ASSERT_EQUAL(400, cams[0].getX());
+    TEST_ASSERT_EQUAL(100, cams[0].getY());
+
+    // Nothing during the wait
+    hostAdvanceMs(50);
+    step();
+    TEST_ASSERT_EQUAL(moveFrames, hostChain().hostWrites());
+    hostAdvanceMs(60);
+    step();
+    TEST_ASSERT_EQUAL(moveFrames + 1, hostChain().hostWrites());
+    assertFrame(moveFrames, flip(true, 1));
+    step();
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"opening\",\"state\":\"done\",\"step\":3,\"steps\":3}",
+        lastReport);
+}
+void test_gate_waits_for_completions() {
+    TEST_ASSERT_TRUE(define(
+        "{\"name\":\"gated\",\"steps\":["
+        "{\"topic\":\"command/camera/settings\",\"flip\":true,\"cam\":0},"
+        "{\"gate\":0,\"timeout\":500},"
+        "{\"topic\":\"command/camera/settings\",\"mirror\":true,\"cam\":0}]}"));
+    TEST_ASSERT_TRUE(runMacro("gated"));
+    step();
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+    assertFrame(0, flip(true, 0));
+
+    // An ACK is not a completion
+    const uint8_t ack[] = {0x90, 0x41, 0xFF};
+    hostChain().hostInput(ack, sizeof(ack));
+    step();
+    hostAdvanceMs(100);
+    step();
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+
+    const uint8_t done[] = {0x90, 0x51, 0xFF};
+    hostChain().hostInput(done, sizeof(done));
+    step();
+    step();
+    TEST_ASSERT_EQUAL(2, hostChain().hostWrites());
+    assertFrame(1, mirror(true, 0));
+    step();
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"gated\",\"state\":\"done\",\"step\":3,\"steps\":3}",
+        lastReport);
+}
+void test_gate_timeout() {
+    const uint32_t timeouts = metrics.macroGateTimeouts;
+    TEST_ASSERT_TRUE(runMacro("gated"));
+    step();
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+    // The gate's 500 ms started before the frame kept the wire busy
+    hostAdvanceMs(450);
+    step();
+    TEST_ASSERT_EQUAL_UINT32(timeouts, metrics.macroGateTimeouts);
+    hostAdvanceMs(50);
+    step();
+    TEST_ASSERT_EQUAL_UINT32(timeouts + 1, metrics.macroGateTimeouts);
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"gated\",\"state\":\"timeout\",\"step\":2,\"steps\":3}",
+        lastReport);
+    // The mirror step never went out
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+}
+void test_failed_redefine_keeps_the_old_version() {
+    TEST_ASSERT_TRUE(define(
+        "{\"name\":\"keep\",\"steps\":["
+        "{\"topic\":\"command/camera/settings\",\"flip\":true,\"cam\":2}]}"));
+    uint8_t before[MACRO_MAX_SIZE];
+    size_t beforeSize;
+    readFile("/macros/keep.vmc", before, beforeSize);
+
+    // Does not compile
+    TEST_ASSERT_FALSE(define(
+        "{\"name\":\"keep\",\"steps\":[{\"topic\":\"command/system/reboot\"}]}"));
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"keep\",\"state\":\"error\",\"error\":\"unsupported topic\"}",
+        lastReport);
+    // Flash write fails
+    LittleFS.hostFailWrites = true;
+    TEST_ASSERT_FALSE(define(
+        "{\"name\":\"keep\",\"steps\":["
+        "{\"topic\":\"command/camera/settings\",\"mirror\":true,\"cam\":2}]}"));
+    LittleFS.hostFailWrites = false;
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"keep\",\"state\":\"error\",\"error\":\"write failed\"}",
+        lastReport);
+    TEST_ASSERT_FALSE(LittleFS.exists("/macros/keep.tmp"));
+
+    uint8_t after[MACRO_MAX_SIZE];
+    size_t afterSize;
+    readFile("/macros/keep.vmc", after, afterSize);
+    TEST_ASSERT_EQUAL(beforeSize, afterSize);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(before, after, beforeSize);
+
+    // From the cache and from flash alike
+    TEST_ASSERT_TRUE(runMacro("keep"));
+    step();
+    assertFrame(0, flip(true, 2));
+    step();
+    define("{\"name\":\"filler1\",\"steps\":[{\"wait\":1}]}");
+    define("{\"name\":\"filler2\",\"steps\":[{\"wait\":1}]}");
+    hostChain().hostClear();
+    const uint32_t loads = metrics.macroLoads;
+    TEST_ASSERT_TRUE(runMacro("keep"));
+    TEST_ASSERT_EQUAL_UINT32(loads + 1, metrics.macroLoads);
+    step();
+    assertFrame(0, flip(true, 2));
+    step();
+}
+void test_redefine_replaces() {
+    const uint32_t allocations = allocationCount();
+    TEST_ASSERT_TRUE(define(
+        "{\"name\":\"keep\",\"steps\":["
+        "{\"topic\":\"command/camera/settings\",\"mirror\":true,\"cam\":2}]}"));
+    // The define document is static, the slot was cached already
+    TEST_ASSERT_EQUAL_UINT32(allocations, allocationCount());
+    TEST_ASSERT_TRUE(runMacro("keep"));
+    step();
+    assertFrame(0, mirror(true, 2));
+    step();
+}
+
+void setUp() { hostChain().hostClear(); }
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    beginBuses();
+    LittleFS.begin();
+    setMacroCallback(collect);
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_gate_waits_for_completions);
+    RUN_TEST(test_gate_timeout);
+    RUN_TEST(test_failed_redefine_keeps_the_old_version);
+    RUN_TEST(test_redefine_replaces);
+    return UNITY_END();
+}
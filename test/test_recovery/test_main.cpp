@@ -0,0 +1,204 @@
+// Error recovery on a simulated chain: which frame a buffer full reply sends
+// again, when a camera is quarantined, what does and does not bring it back,
+// and the probes sent in between.
+#include <Arduino.h>
+#include <bus.h>
+#include <commands.h>
+#include <host_visca.h>
+#include <recovery.h>
+#include <scheduler.h>
+#include <unity.h>
+
+#define EVENTS 32
+
+static char events[EVENTS][96];
+static uint8_t eventCount = 0;
+
+static void collect(const char* message) {
+    if (eventCount < EVENTS) {
+        strncpy(events[eventCount], message, sizeof(events[0]) - 1);
+    }
+    eventCount++;
+}
+static bool reported(const char* event) {
+    char needle[48];
+    snprintf(needle, sizeof(needle), "\"event\":\"%s\"", event);
+    for (uint8_t i = 0; i < eventCount && i < EVENTS; i++) {
+        if (strstr(events[i], needle)) {
+            return true;
+        }
+    }
+    return false;
+}
+static void cameraSays(const uint8_t* frame, size_t length) {
+    hostChain().hostInput(frame, length);
+    serviceBuses();
+}
+
+// Camera 0 at address 1
+static const uint8_t ack[] = {0x90, 0x41, 0xFF};
+static const uint8_t done[] = {0x90, 0x51, 0xFF};
+static const uint8_t clearDone[] = {0x90, 0x50, 0xFF};
+static const uint8_t notExecutable[] = {0x90, 0x61, 0x41, 0xFF};
+static const uint8_t power[] = {0x90, 0x50, 0x02, 0xFF};
+
+// A camera that takes every command and then cannot execute it, answering
+// the IF_Clear after each third fault like any camera does
+static void failCommands(uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        cameraSays(ack, sizeof(ack));
+        cameraSays(notExecutable, sizeof(notExecutable));
+        if ((i + 1) % RECOVERY_CLEAR_AFTER == 0) {
+            cameraSays(clearDone, sizeof(clearDone));
+        }
+        hostAdvanceMs(10);
+    }
+}
+static void quarantine() {
+    failCommands(RECOVERY_CLEAR_AFTER * RECOVERY_QUARANTINE_AFTER);
+    TEST_ASSERT_FALSE(cameraAvailable(0));
+}
+// Probes go through the bus queue like any frame, one per pass
+static void probe() {
+    serviceRecovery();
+    serviceBuses();
+    serviceBuses();
+}
+static void lift() {
+    hostAdvanceMs(RECOVERY_PROBE_MS + 1);
+    probe();
+    cameraSays(power, sizeof(power));
+    TEST_ASSERT_TRUE(cameraAvailable(0));
+}
+
+void test_buffer_full_retries_only_that_frame() {
+    // Two frames in one command, the camera has no room for the first
+    VISCACommand command = flip(true, 0);
+    const VISCACommand second = mirror(true, 0);
+    memcpy(command.payload + command.len, second.payload, second.len);
+    command.len += second.len;
+    TEST_ASSERT_TRUE(busEnqueue(0, command, TOPIC_CAMERA_SETTINGS));
+    serviceBuses();
+    hostChain().hostClear();
+    const uint8_t bufferFull[] = {0x90, 0x60, 0x03, 0xFF};
+    cameraSays(bufferFull, sizeof(bufferFull));
+    cameraSays(ack, sizeof(ack));
+    TEST_ASSERT_TRUE(reported("bufferFull"));
+    TEST_ASSERT_EQUAL_UINT32(1, cameraErrors(0).retries);
+
+    ScheduleReport report;
+    hostAdvanceMs(RECOVERY_BACKOFF_MS + SCHEDULER_TICK_MS);
+    TEST_ASSERT_TRUE(runScheduler(report));
+    TEST_ASSERT_EQUAL(1, report.frames);
+    const VISCACommand first = flip(true, 0);
+    TEST_ASSERT_EQUAL(first.len, hostChain().hostLength());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(first.payload, hostChain().hostBytes(),
+                                 first.len);
+
+    // Once the resent frame is ACKed, nothing is left to send again
+    cameraSays(ack, sizeof(ack));
+    cameraSays(bufferFull, sizeof(bufferFull));
+    TEST_ASSERT_EQUAL_UINT32(1, cameraErrors(0).retries);
+}
+void test_not_executable_after_ack_quarantines() {
+    failCommands(RECOVERY_CLEAR_AFTER * RECOVERY_QUARANTINE_AFTER - 1);
+    TEST_ASSERT_TRUE(cameraAvailable(0));
+    TEST_ASSERT_EQUAL_UINT32(RECOVERY_QUARANTINE_AFTER - 1,
+                             cameraErrors(0).clears);
+    failCommands(1);
+    TEST_ASSERT_FALSE(cameraAvailable(0));
+    TEST_ASSERT_TRUE(reported("quarantined"));
+    TEST_ASSERT_FALSE(busEnqueue(0, flip(true, 0)));
+    lift();
+}
+void test_clear_completion_does_not_lift() {
+    quarantine();
+    // The answer to the IF_Clear that went with the quarantine, and to later
+    // probes
+    cameraSays(clearDone, sizeof(clearDone));
+    TEST_ASSERT_FALSE(cameraAvailable(0));
+    hostAdvanceMs(RECOVERY_PROBE_MS + 1);
+    probe();
+    cameraSays(clearDone, sizeof(clearDone));
+    TEST_ASSERT_FALSE(cameraAvailable(0));
+    TEST_ASSERT_FALSE(reported("recovered"));
+    lift();
+}
+void test_probe_is_clear_and_power_inquiry() {
+    quarantine();
+    hostChain().hostClear();
+    hostAdvanceMs(RECOVERY_PROBE_MS - 100);
+    probe();
+    TEST_ASSERT_EQUAL(0, hostChain().hostWrites());
+    hostAdvanceMs(100);
+    probe();
+    const uint8_t frames[] = {0x81, 0x01, 0x00, 0x01, 0xFF,
+                              0x81, 0x09, 0x04, 0x00, 0xFF};
+    TEST_ASSERT_EQUAL(2, hostChain().hostWrites());
+    TEST_ASSERT_EQUAL(sizeof(frames), hostChain().hostLength());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(frames, hostChain().hostBytes(),
+                                 sizeof(frames));
+
+    // A camera that stays silent keeps being probed
+    for (uint8_t i = 0; i < 3; i++) {
+        hostAdvanceMs(RECOVERY_PROBE_MS + 1);
+        probe();
+    }
+    TEST_ASSERT_EQUAL(4 * sizeof(frames), hostChain().hostLength());
+    TEST_ASSERT_FALSE(cameraAvailable(0));
+    lift();
+}
+void test_power_reply_lifts_and_is_consumed() {
+    quarantine();
+    hostAdvanceMs(RECOVERY_PROBE_MS + 1);
+    probe();
+    TEST_ASSERT_TRUE(recoveryOnReply(0, power, sizeof(power)));
+    TEST_ASSERT_TRUE(cameraAvailable(0));
+    TEST_ASSERT_TRUE(reported("recovered"));
+    TEST_ASSERT_TRUE(busEnqueue(0, flip(true, 0)));
+    serviceBuses();
+    // Outside quarantine a power reply is just a reply
+    TEST_ASSERT_FALSE(recoveryOnReply(0, power, sizeof(power)));
+}
+void test_ack_lifts() {
+    quarantine();
+    cameraSays(ack, sizeof(ack));
+    TEST_ASSERT_TRUE(cameraAvailable(0));
+}
+void test_completed_command_resets_the_count() {
+    failCommands(RECOVERY_CLEAR_AFTER * (RECOVERY_QUARANTINE_AFTER - 1));
+    cameraSays(ack, sizeof(ack));
+    cameraSays(done, sizeof(done));
+    // Needs the full count again
+    failCommands(RECOVERY_CLEAR_AFTER * (RECOVERY_QUARANTINE_AFTER - 1));
+    TEST_ASSERT_TRUE(cameraAvailable(0));
+    failCommands(RECOVERY_CLEAR_AFTER);
+    TEST_ASSERT_FALSE(cameraAvailable(0));
+    lift();
+}
+
+void setUp() {
+    // Whatever the last test left queued
+    for (uint8_t i = 0; i < VISCA_BUS_QUEUE; i++) {
+        serviceBuses();
+    }
+    hostChain().hostClear();
+    eventCount = 0;
+    // A fresh fault window
+    hostAdvanceMs(RECOVERY_FAULT_WINDOW_MS + 1);
+}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    beginBuses();
+    setRecoveryCallback(collect);
+    UNITY_BEGIN();
+    RUN_TEST(test_buffer_full_retries_only_that_frame);
+    RUN_TEST(test_not_executable_after_ack_quarantines);
+    RUN_TEST(test_clear_completion_does_not_lift);
+    RUN_TEST(test_probe_is_clear_and_power_inquiry);
+    RUN_TEST(test_power_reply_lifts_and_is_consumed);
+    RUN_TEST(test_ack_lifts);
+    RUN_TEST(test_completed_command_resets_the_count);
+    return UNITY_END();
+}
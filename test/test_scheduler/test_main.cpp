@@ -0,0 +1,180 @@
+// Timer wheel against a simulated camera chain: bus 0 is a host
+// SoftwareSerial that keeps the CPU for 1042 us per byte like the real one,
+// and logs when every frame started.
+#include <Arduino.h>
+#include <bus.h>
+#include <commands.h>
+#include <host_visca.h>
+#include <scheduler.h>
+#include <unity.h>
+
+// Camera the n-th frame on the chain was addressed to
+static uint8_t frameCam(uint16_t n) {
+    return (hostChain().hostBytes()[hostChain().hostWrite(n).offset] & 0x0F) - 1;
+}
+// Runs the scheduler once per ms, like loop() does, until it releases a
+// batch or the bridge clock passes until. Returns whether it released.
+static bool runUntil(uint32_t until, ScheduleReport& report) {
+    while ((int32_t)(bridgeMillis() - until) <= 0) {
+        if (runScheduler(report)) {
+            return true;
+        }
+        hostAdvanceMs(1);
+    }
+    return false;
+}
+
+void test_same_at_batch_goes_out_in_order() {
+    const uint32_t at = bridgeMillis() + 100;
+    const VISCACommand moves[] = {relativeMovement(10, 0, 2),
+                                  flip(true, 0), clearBuffer(1)};
+    for (const VISCACommand& move : moves) {
+        TEST_ASSERT_TRUE(scheduleCommand(move, (move.payload[0] & 0x0F) - 1,
+                                         at));
+    }
+
+    ScheduleReport report;
+    TEST_ASSERT_TRUE(runUntil(at + 50, report));
+    TEST_ASSERT_EQUAL_UINT32(at, report.at);
+    TEST_ASSERT_EQUAL_UINT32(0, report.lateMs);
+    TEST_ASSERT_EQUAL(3, report.frames);
+
+    // Arrival order, back to back
+    TEST_ASSERT_EQUAL(3, hostChain().hostWrites());
+    TEST_ASSERT_EQUAL(2, frameCam(0));
+    TEST_ASSERT_EQUAL(0, frameCam(1));
+    TEST_ASSERT_EQUAL(1, frameCam(2));
+    for (uint8_t i = 1; i < 3; i++) {
+        TEST_ASSERT_EQUAL_UINT32(
+            hostChain().hostWrite(i - 1).startUs +
+                moves[i - 1].len * HOST_BAUD_BYTE_US,
+            hostChain().hostWrite(i).startUs);
+    }
+    // Skew is the time the earlier frames kept the wire busy
+    TEST_ASSERT_EQUAL_UINT32((moves[0].len + moves[1].len) * HOST_BAUD_BYTE_US,
+                             report.skewUs);
+}
+void test_earlier_at_in_same_tick_goes_first() {
+    const uint32_t base = (bridgeMillis() / SCHEDULER_TICK_MS + 20) *
+                          SCHEDULER_TICK_MS;
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 3), 3, base + 5));
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 4), 4, base + 2));
+
+    ScheduleReport report;
+    TEST_ASSERT_TRUE(runUntil(base + 10, report));
+    TEST_ASSERT_EQUAL_UINT32(base + 2, report.at);
+    TEST_ASSERT_EQUAL(1, report.frames);
+    TEST_ASSERT_TRUE(runUntil(base + 10, report));
+    TEST_ASSERT_EQUAL_UINT32(base + 5, report.at);
+    TEST_ASSERT_EQUAL(4, frameCam(0));
+    TEST_ASSERT_EQUAL(3, frameCam(1));
+}
+void test_lateness_when_loop_was_busy() {
+    const uint32_t at = bridgeMillis() + 40;
+    TEST_ASSERT_TRUE(scheduleCommand(mirror(true, 0), 0, at));
+    // Something held loop() up for 25 ms past the target
+    hostAdvanceMs(65);
+    ScheduleReport report;
+    TEST_ASSERT_TRUE(runScheduler(report));
+    TEST_ASSERT_EQUAL_UINT32(at, report.at);
+    TEST_ASSERT_EQUAL_UINT32(25, report.lateMs);
+    TEST_ASSERT_EQUAL_UINT32(0, report.skewUs);
+}
+void test_bridge_time_jumps_forward() {
+    const uint32_t at = bridgeMillis() + 1000;
+    TEST_ASSERT_TRUE(scheduleCommand(flip(false, 0), 0, at));
+    ScheduleReport report;
+    TEST_ASSERT_FALSE(runUntil(at - 900, report));
+
+    // The controller's clock is 4 s ahead: the entry is overdue now
+    setBridgeTime(at + 3000);
+    TEST_ASSERT_TRUE(runScheduler(report));
+    TEST_ASSERT_EQUAL_UINT32(at, report.at);
+    TEST_ASSERT_EQUAL_UINT32(3000, report.lateMs);
+}
+void test_bridge_time_jumps_back() {
+    const uint32_t at = bridgeMillis() + 100;
+    TEST_ASSERT_TRUE(scheduleCommand(flip(false, 1), 1, at));
+    setBridgeTime(at - 1100);
+
+    // Keeps its absolute time, so it waits the extra second
+    const unsigned long start = millis();
+    ScheduleReport report;
+    TEST_ASSERT_TRUE(runUntil(at + 10, report));
+    TEST_ASSERT_EQUAL_UINT32(at, report.at);
+    TEST_ASSERT_EQUAL_UINT32(0, report.lateMs);
+    TEST_ASSERT_EQUAL_UINT32(1100,
+                             hostChain().hostWrite(0).startUs / 1000 - start);
+}
+void test_wheel_wrap_around() {
+    // One round of the wheel is SCHEDULER_SLOTS * SCHEDULER_TICK_MS = 256 ms.
+    // Entries in the same slot but later rounds stay put until their time.
+    const uint32_t round = SCHEDULER_SLOTS * SCHEDULER_TICK_MS;
+    const uint32_t at = bridgeMillis() + 30;
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 0), 0, at));
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 1), 1, at + round));
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 2), 2, at + 3 * round));
+
+    ScheduleReport report;
+    for (uint8_t i = 0; i < 3; i++) {
+        const uint32_t expected = at + (i == 2 ? 3 : i) * round;
+        TEST_ASSERT_TRUE(runUntil(expected + round, report));
+        TEST_ASSERT_EQUAL_UINT32(expected, report.at);
+        TEST_ASSERT_EQUAL_UINT32(0, report.lateMs);
+        TEST_ASSERT_EQUAL(1, report.frames);
+        TEST_ASSERT_EQUAL(i, frameCam(i));
+    }
+}
+void test_stall_longer_than_a_round() {
+    // loop() did not run for more than a full round: everything due in
+    // between still goes out, in one batch and in order
+    const uint32_t at = bridgeMillis() + 10;
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 5), 5, at + 200));
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 6), 6, at));
+    TEST_ASSERT_TRUE(scheduleCommand(flip(true, 4), 4, at + 900));
+    hostAdvanceMs(600);
+
+    ScheduleReport report;
+    TEST_ASSERT_TRUE(runScheduler(report));
+    TEST_ASSERT_EQUAL_UINT32(at, report.at);
+    TEST_ASSERT_EQUAL(2, report.frames);
+    TEST_ASSERT_EQUAL(6, frameCam(0));
+    TEST_ASSERT_EQUAL(5, frameCam(1));
+    TEST_ASSERT_TRUE(runUntil(at + 900, report));
+    TEST_ASSERT_EQUAL_UINT32(at + 900, report.at);
+}
+void test_capacity() {
+    const uint32_t at = bridgeMillis() + 50;
+    for (uint8_t i = 0; i < SCHEDULER_MAX_ENTRIES; i++) {
+        TEST_ASSERT_TRUE(scheduleCommand(clearBuffer(0), 0, at + i));
+    }
+    TEST_ASSERT_FALSE(scheduleCommand(clearBuffer(0), 0, at));
+
+    // Released entries are free again
+    ScheduleReport report;
+    TEST_ASSERT_TRUE(runUntil(at, report));
+    uint8_t released = report.frames;
+    TEST_ASSERT_TRUE(scheduleCommand(clearBuffer(0), 0, at + 100));
+    while (runUntil(at + 100, report)) {
+        released += report.frames;
+    }
+    TEST_ASSERT_EQUAL(SCHEDULER_MAX_ENTRIES + 1, released);
+}
+
+void setUp() { hostChain().hostClear(); }
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    beginBuses();
+    setBridgeTime(100000);
+    UNITY_BEGIN();
+    RUN_TEST(test_same_at_batch_goes_out_in_order);
+    RUN_TEST(test_earlier_at_in_same_tick_goes_first);
+    RUN_TEST(test_lateness_when_loop_was_busy);
+    RUN_TEST(test_bridge_time_jumps_forward);
+    RUN_TEST(test_bridge_time_jumps_back);
+    RUN_TEST(test_wheel_wrap_around);
+    RUN_TEST(test_stall_longer_than_a_round);
+    RUN_TEST(test_capacity);
+    return UNITY_END();
+}
@@ -0,0 +1,130 @@
+// Soak: the whole bridge (setup() and loop() from main.cpp) connected to the
+// host broker, fed thousands of mixed commands and camera replies. Once
+// connected, the message and reply paths must not touch the heap at all.
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <bus.h>
+#include <metrics.h>
+#include <unity.h>
+
+extern PubSubClient client;
+void setup();
+void loop();
+
+static void deliver(const char* subTopic, const char* payload) {
+    char topic[HOST_MQTT_TOPIC];
+    snprintf(topic, sizeof(topic), "VISCA/%s", subTopic);
+    client.hostDeliver(topic, payload);
+}
+static void reply(const uint8_t* frame, size_t length) {
+    static_cast<HostSerialPort*>(buses[0].port)->hostInput(frame, length);
+}
+
+// One round of everything a show sends, with values that change per round
+static void exchange(uint32_t round) {
+    char payload[128];
+    const uint8_t cam = round % NUM_CAMS;
+    snprintf(payload, sizeof(payload),
+             "{\"x\":%lu,\"y\":100,\"z\":500,\"cam\":%u}",
+             (unsigned long)(round % 800), cam);
+    deliver("command/camera/moveto", payload);
+    snprintf(payload, sizeof(payload), "{\"x\":%d,\"y\":-10,\"cam\":%u}",
+             (int)(round % 200) - 100, cam);
+    deliver("command/camera/moveby", payload);
+    deliver("command/camera/velocity", payload);
+    deliver("command/camera/settings", "{\"backlight\":true,\"cam\":0}");
+    deliver("command/camera/picture", "{\"wb\":7,\"iris\":-1,\"cam\":3}");
+    deliver("command/camera/blinkenlights", "{\"led\":1,\"mode\":2}");
+    snprintf(payload, sizeof(payload),
+             "{\"cam\":%u,\"maxAge\":%lu,\"id\":%lu}", cam,
+             (unsigned long)(round % 3) * 500, (unsigned long)round);
+    deliver("command/camera/getState", payload);
+    deliver("command/camera/errors", "{\"cam\":3}");
+    snprintf(payload, sizeof(payload), "{\"x\":400,\"cam\":%u,\"at\":%lu}",
+             cam, (unsigned long)(millis() + 50));
+    deliver("command/camera/moveto", payload);
+    deliver("command/system/time", "{}");
+    deliver("command/system/metrics", "{}");
+    // Echo of our own moveby output, dropped by topic
+    deliver("return/camera/rawdata", "x");
+    deliver("command/camera/velocity", "not json");
+    const uint8_t raw[] = {0x81, 0x01, 0x00, 0x01, 0xFF};
+    client.hostDeliver("VISCA/command/camera/raw", raw, sizeof(raw));
+
+    // What the cameras say back: ACK, completion, inquiry replies
+    const uint8_t ack[] = {0x90, 0x41, 0xFF};
+    const uint8_t done[] = {0x90, 0x51, 0xFF};
+    const uint8_t panTilt[] = {0x90, 0x50, 0x00, 0x01, 0x09, 0x00,
+                               0x00, 0x00, 0x06, 0x0A, 0xFF};
+    const uint8_t zoom[] = {0x90, 0x50, 0x00, 0x05, 0x0A, 0x02, 0xFF};
+    const uint8_t focus[] = {0x90, 0x50, 0x00, 0x09, 0x0C, 0x04, 0xFF};
+    const uint8_t power[] = {0x90, 0x50, 0x02, 0xFF};
+    reply(ack, sizeof(ack));
+    reply(done, sizeof(done));
+    reply(panTilt, sizeof(panTilt));
+    reply(zoom, sizeof(zoom));
+    reply(focus, sizeof(focus));
+    reply(power, sizeof(power));
+
+    for (uint8_t i = 0; i < 20; i++) {
+        loop();
+        hostAdvanceMs(5);
+    }
+}
+
+void test_allocator_is_wrapped() {
+    // Makes sure the zero below is measured and not just missing
+    uint32_t before = allocationCount();
+    void* volatile block = malloc(16);
+    free(block);
+    TEST_ASSERT_EQUAL_UINT32(before + 1, allocationCount());
+
+    before = metrics.networkAllocations;
+    beginNetworkCall();
+    block = malloc(16);
+    free(block);
+    endNetworkCall();
+    TEST_ASSERT_EQUAL_UINT32(before + 1, metrics.networkAllocations);
+}
+void test_no_allocations_per_message() {
+    TEST_ASSERT_TRUE(client.connected());
+    // Warm up once: first use of anything lazily initialized
+    exchange(0);
+    metrics.steadyAllocations = 0;
+    metrics.allocatingMessages = 0;
+    const uint32_t messagesBefore = metrics.messages;
+    const uint32_t repliesBefore = metrics.replies;
+    const uint32_t networkBefore = metrics.networkAllocations;
+    const uint32_t allocationsBefore = allocationCount();
+
+    for (uint32_t round = 1; round <= 1000; round++) {
+        exchange(round);
+    }
+
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(messagesBefore + 14000,
+                                        metrics.messages);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(repliesBefore + 6000,
+                                        metrics.replies);
+    TEST_ASSERT_EQUAL_UINT32(0, metrics.steadyAllocations);
+    TEST_ASSERT_EQUAL_UINT32(0, metrics.allocatingMessages);
+    // Not only inside dispatchCommand()/parseCommand(), loop() as a whole
+    TEST_ASSERT_EQUAL_UINT32(allocationsBefore, allocationCount());
+    // The broker stand-in allocates a pbuf per publish like lwIP, and those
+    // are kept apart
+    TEST_ASSERT_GREATER_THAN_UINT32(networkBefore, metrics.networkAllocations);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    WiFi.hostStatus = WL_CONNECTED;
+    setup();
+    for (uint8_t i = 0; i < 10 && !client.connected(); i++) {
+        loop();
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_allocator_is_wrapped);
+    RUN_TEST(test_no_allocations_per_message);
+    return UNITY_END();
+}
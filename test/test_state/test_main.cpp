@@ -0,0 +1,147 @@
+// getState cache and inquiry coalescing on a simulated chain: every requester
+// gets exactly one answer, also when the answer is an error.
+#include <Arduino.h>
+#include <bus.h>
+#include <host_visca.h>
+#include <recovery.h>
+#include <state.h>
+#include <trace.h>
+#include <unity.h>
+
+#define ANSWERS 16
+
+static char answers[ANSWERS][256];
+static CommandOrigin origins[ANSWERS];
+static uint8_t answerCount = 0;
+
+static void collect(CommandOrigin origin, const char* message) {
+    if (answerCount < ANSWERS) {
+        origins[answerCount] = origin;
+        strncpy(answers[answerCount], message, sizeof(answers[0]) - 1);
+    }
+    answerCount++;
+}
+static bool startsWith(const char* text, const char* prefix) {
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
+// The three inquiry replies, camera at address 1 + cam
+static void answerInquiry(uint8_t cam) {
+    const uint8_t header = 0x90 + (cam << 4);
+    const uint8_t panTilt[] = {header, 0x50, 0x00, 0x01, 0x09, 0x00,
+                               0x00, 0x00, 0x06, 0x0A, 0xFF};
+    const uint8_t zoom[] = {header, 0x50, 0x00, 0x05, 0x0A, 0x02, 0xFF};
+    const uint8_t focus[] = {header, 0x50, 0x00, 0x09, 0x0C, 0x04, 0xFF};
+    hostChain().hostInput(panTilt, sizeof(panTilt));
+    hostChain().hostInput(zoom, sizeof(zoom));
+    hostChain().hostInput(focus, sizeof(focus));
+    serviceBuses();
+}
+static const CommandOrigin mqtt = {TRACE_MQTT, 0};
+
+void test_inquiry_then_cache() {
+    TEST_ASSERT_EQUAL(STATE_INQUIRY_SENT, requestState(0, 0, 1, mqtt));
+    serviceBuses();
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+    TEST_ASSERT_EQUAL(0, answerCount);
+    answerInquiry(0);
+    TEST_ASSERT_EQUAL(1, answerCount);
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"cam\":0,\"ids\":[1],\"x\":400,\"y\":106,\"z\":1442,"
+        "\"focus\":2500,\"age\":0,\"cached\":false}",
+        answers[0]);
+
+    TEST_ASSERT_EQUAL(STATE_HIT, requestState(0, 1000, 2, mqtt));
+    TEST_ASSERT_EQUAL(2, answerCount);
+    TEST_ASSERT_TRUE(startsWith(answers[1], "{\"cam\":0,\"ids\":[2],\"x\":400"));
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+}
+void test_requester_past_the_limit_gets_an_error() {
+    TEST_ASSERT_EQUAL(STATE_INQUIRY_SENT, requestState(1, 0, 100, mqtt));
+    for (uint32_t id = 101; id < 100 + STATE_MAX_WAITERS; id++) {
+        TEST_ASSERT_EQUAL(STATE_COALESCED, requestState(1, 0, id, mqtt));
+    }
+    TEST_ASSERT_EQUAL(0, answerCount);
+
+    // The 9th is answered right away instead of being dropped
+    TEST_ASSERT_EQUAL(STATE_FAILED, requestState(1, 0, 999, mqtt));
+    TEST_ASSERT_EQUAL(1, answerCount);
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"cam\":1,\"ids\":[999],\"error\":\"too many requests\"}",
+        answers[0]);
+
+    serviceBuses();
+    answerInquiry(1);
+    TEST_ASSERT_EQUAL(2, answerCount);
+    TEST_ASSERT_TRUE(startsWith(
+        answers[1],
+        "{\"cam\":1,\"ids\":[100,101,102,103,104,105,106,107],\"x\":400"));
+}
+void test_answers_per_origin() {
+    const CommandOrigin socket1 = {TRACE_WEBSOCKET, 1};
+    const CommandOrigin socket2 = {TRACE_WEBSOCKET, 2};
+    requestState(2, 0, 1, socket1);
+    requestState(2, 0, 2, mqtt);
+    requestState(2, 0, 3, socket2);
+    requestState(2, 0, 4, socket1);
+    serviceBuses();
+    answerInquiry(2);
+    TEST_ASSERT_EQUAL(3, answerCount);
+    TEST_ASSERT_EQUAL(1, origins[0].client);
+    TEST_ASSERT_TRUE(startsWith(answers[0], "{\"cam\":2,\"ids\":[1,4],"));
+    TEST_ASSERT_EQUAL(TRACE_MQTT, origins[1].source);
+    TEST_ASSERT_TRUE(startsWith(answers[1], "{\"cam\":2,\"ids\":[2],"));
+    TEST_ASSERT_EQUAL(2, origins[2].client);
+    TEST_ASSERT_TRUE(startsWith(answers[2], "{\"cam\":2,\"ids\":[3],"));
+}
+void test_timeout() {
+    requestState(3, 0, 7, mqtt);
+    serviceBuses();
+    hostAdvanceMs(STATE_INQUIRY_TIMEOUT_MS + 1);
+    serviceState();
+    TEST_ASSERT_EQUAL(1, answerCount);
+    TEST_ASSERT_EQUAL_STRING("{\"cam\":3,\"ids\":[7],\"error\":\"timeout\"}",
+                             answers[0]);
+}
+void test_full_bus_queue() {
+    for (uint8_t i = 0; i < VISCA_BUS_QUEUE; i++) {
+        TEST_ASSERT_TRUE(busEnqueue(5, clearBuffer(5)));
+    }
+    TEST_ASSERT_EQUAL(STATE_FAILED, requestState(4, 0, 8, mqtt));
+    TEST_ASSERT_EQUAL_STRING("{\"cam\":4,\"ids\":[8],\"error\":\"bus busy\"}",
+                             answers[0]);
+    for (uint8_t i = 0; i < VISCA_BUS_QUEUE; i++) {
+        serviceBuses();
+    }
+}
+void test_quarantined_camera() {
+    // Syntax errors until recovery gives up on the camera
+    const uint8_t syntax[] = {0x95, 0x61, 0x02, 0xFF};
+    for (uint8_t i = 0; i < RECOVERY_CLEAR_AFTER * RECOVERY_QUARANTINE_AFTER;
+         i++) {
+        recoveryOnReply(4, syntax, sizeof(syntax));
+    }
+    TEST_ASSERT_FALSE(cameraAvailable(4));
+
+    TEST_ASSERT_EQUAL(STATE_FAILED, requestState(4, 0, 9, mqtt));
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"cam\":4,\"ids\":[9],\"error\":\"quarantined\"}", answers[0]);
+}
+
+void setUp() {
+    hostChain().hostClear();
+    answerCount = 0;
+}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    beginBuses();
+    setStateCallback(collect);
+    UNITY_BEGIN();
+    RUN_TEST(test_inquiry_then_cache);
+    RUN_TEST(test_requester_past_the_limit_gets_an_error);
+    RUN_TEST(test_answers_per_origin);
+    RUN_TEST(test_timeout);
+    RUN_TEST(test_full_bus_queue);
+    RUN_TEST(test_quarantined_camera);
+    return UNITY_END();
+}
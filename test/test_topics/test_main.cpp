@@ -0,0 +1,78 @@
+// Topic filtering against the whole bridge: it only subscribes to the command
+// subtrees, its own output stays outside them, and whatever arrives on a topic
+// without a handler is dropped before any JSON parsing.
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <host_visca.h>
+#include <metrics.h>
+#include <unity.h>
+
+extern PubSubClient client;
+void setup();
+void loop();
+
+void test_subscribes_to_command_subtrees_only() {
+    TEST_ASSERT_TRUE(client.hostSubscribed("VISCA/command/camera/moveto"));
+    TEST_ASSERT_TRUE(client.hostSubscribed("VISCA/command/system/metrics"));
+    TEST_ASSERT_FALSE(client.hostSubscribed("VISCA/return/camera/raw"));
+    TEST_ASSERT_FALSE(client.hostSubscribed("VISCA/return/system"));
+    TEST_ASSERT_FALSE(client.hostSubscribed("VISCA/system/status"));
+}
+void test_moveby_echo_stays_outside_the_subscriptions() {
+    client.hostDeliver("VISCA/command/camera/moveby", "{\"x\":30,\"cam\":1}");
+    const PubSubClient::Message* echo = client.hostLast("/rawdata");
+    TEST_ASSERT_NOT_NULL(echo);
+    TEST_ASSERT_EQUAL_STRING("VISCA/return/camera/rawdata", echo->topic);
+    TEST_ASSERT_FALSE(client.hostSubscribed(echo->topic));
+    TEST_ASSERT_EQUAL_HEX8(0x82, echo->payload[0]);
+    serviceBuses();
+}
+void test_echo_is_dropped_before_parsing() {
+    // A broker that hands the echo back anyway, e.g. to a wildcard
+    // subscription from an older firmware
+    client.hostDeliver("VISCA/command/camera/moveby", "{\"x\":30,\"cam\":1}");
+    const PubSubClient::Message* echo = client.hostLast("/rawdata");
+    TEST_ASSERT_NOT_NULL(echo);
+    const uint32_t dropped = metrics.droppedMessages;
+    const uint32_t parses = metrics.jsonParses;
+    client.hostDeliver(echo->topic, echo->payload, echo->length);
+    TEST_ASSERT_EQUAL_UINT32(dropped + 1, metrics.droppedMessages);
+    TEST_ASSERT_EQUAL_UINT32(parses, metrics.jsonParses);
+    TraceRecord record;
+    TEST_ASSERT_TRUE(hostLastTrace(TRACE_MQTT, record));
+    TEST_ASSERT_EQUAL(TRACE_UNKNOWN_TOPIC, record.outcome);
+    serviceBuses();
+}
+void test_unknown_command_topics_are_dropped_before_parsing() {
+    const uint32_t dropped = metrics.droppedMessages;
+    const uint32_t parses = metrics.jsonParses;
+    hostChain().hostClear();
+    client.hostDeliver("VISCA/command/camera/nothing", "{\"x\":30}");
+    client.hostDeliver("OTHER/command/camera/moveby", "{\"x\":30}");
+    TEST_ASSERT_EQUAL_UINT32(dropped + 2, metrics.droppedMessages);
+    TEST_ASSERT_EQUAL_UINT32(parses, metrics.jsonParses);
+    serviceBuses();
+    TEST_ASSERT_EQUAL(0, hostChain().hostWrites());
+
+    // A known one is parsed
+    client.hostDeliver("VISCA/command/system/time", "{}");
+    TEST_ASSERT_EQUAL_UINT32(dropped + 2, metrics.droppedMessages);
+    TEST_ASSERT_EQUAL_UINT32(parses + 1, metrics.jsonParses);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    WiFi.hostStatus = WL_CONNECTED;
+    setup();
+    for (uint8_t i = 0; i < 10 && !client.connected(); i++) {
+        loop();
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_subscribes_to_command_subtrees_only);
+    RUN_TEST(test_moveby_echo_stays_outside_the_subscriptions);
+    RUN_TEST(test_echo_is_dropped_before_parsing);
+    RUN_TEST(test_unknown_command_topics_are_dropped_before_parsing);
+    return UNITY_END();
+}
@@ -0,0 +1,118 @@
+// Joystick velocity: deadzone, expo curve and the falloff toward telephoto,
+// checked against hand-computed entries of the speed table, and the drive
+// frame the velocity topic sends for a camera's zoom.
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <commands.h>
+#include <unity.h>
+#include <velocity.h>
+
+// Zoom positions at the edges of the 8 table steps (step = z * 8 / 2886)
+#define LAST_WIDE_ZOOM 360
+#define FIRST_STEP1_ZOOM 361
+
+void test_deadzone() {
+    for (int input = 0; input <= 5; input++) {
+        TEST_ASSERT_EQUAL(0, velocitySpeed(input, 0));
+        TEST_ASSERT_EQUAL(0, velocitySpeed(-input, MAXZ));
+    }
+    // Right past it the camera moves, however slowly
+    TEST_ASSERT_EQUAL(1, velocitySpeed(6, 0));
+    TEST_ASSERT_EQUAL(1, velocitySpeed(6, MAXZ));
+}
+void test_full_stick() {
+    // Full speed at wide, 15 % of it at full tele: 31 * 0.15 = 4.65
+    TEST_ASSERT_EQUAL(VELOCITY_MAX_SPEED, velocitySpeed(100, 0));
+    TEST_ASSERT_EQUAL(VELOCITY_MAX_SPEED, velocitySpeed(-100, 0));
+    TEST_ASSERT_EQUAL(5, velocitySpeed(100, MAXZ));
+    // Past the stick's travel and the zoom range it saturates
+    TEST_ASSERT_EQUAL(VELOCITY_MAX_SPEED, velocitySpeed(250, -10));
+    TEST_ASSERT_EQUAL(5, velocitySpeed(-250, MAXZ + 1000));
+}
+void test_expo_curve() {
+    // travel (50 - 5) / 95 = 0.4737, 0.6 * 0.4737 + 0.4 * 0.4737^3 = 0.3267,
+    // times 31 is 10.13
+    TEST_ASSERT_EQUAL(10, velocitySpeed(50, 0));
+    // travel 0.7368: 0.4421 + 0.1600 = 0.6021, times 31 is 18.67
+    TEST_ASSERT_EQUAL(19, velocitySpeed(75, 0));
+}
+void test_zoom_steps() {
+    TEST_ASSERT_EQUAL(VELOCITY_MAX_SPEED, velocitySpeed(100, LAST_WIDE_ZOOM));
+    // Step 1 keeps 1 - 0.85 / 7 = 87.86 %: 27.24
+    TEST_ASSERT_EQUAL(27, velocitySpeed(100, FIRST_STEP1_ZOOM));
+}
+void test_falloff_toward_tele() {
+    for (int input = 6; input <= 100; input++) {
+        byte previous = velocitySpeed(input, 0);
+        for (int zoom = 0; zoom <= MAXZ; zoom += 50) {
+            const byte speed = velocitySpeed(input, zoom);
+            TEST_ASSERT_LESS_OR_EQUAL(previous, speed);
+            TEST_ASSERT_GREATER_OR_EQUAL(1, speed);
+            previous = speed;
+        }
+        // and never faster with less stick
+        TEST_ASSERT_GREATER_OR_EQUAL(velocitySpeed(input - 1, MAXZ),
+                                     velocitySpeed(input, MAXZ));
+    }
+}
+void test_config() {
+    // Linear, no deadzone, no falloff: 0.5 * 31 = 15.5 rounds up
+    setVelocityConfig({0, 0, 100});
+    TEST_ASSERT_EQUAL(16, velocitySpeed(50, 0));
+    TEST_ASSERT_EQUAL(16, velocitySpeed(50, MAXZ));
+    TEST_ASSERT_EQUAL(1, velocitySpeed(1, 0));
+    TEST_ASSERT_EQUAL(0, velocitySpeed(0, 0));
+
+    // Fully cubic: 0.125 * 31 = 3.88
+    setVelocityConfig({0, 100, 100});
+    TEST_ASSERT_EQUAL(4, velocitySpeed(50, 0));
+
+    // Out of range values are clamped
+    setVelocityConfig({150, 200, 0});
+    TEST_ASSERT_EQUAL(99, velocityConfig.deadzone);
+    TEST_ASSERT_EQUAL(100, velocityConfig.expo);
+    TEST_ASSERT_EQUAL(1, velocityConfig.teleScale);
+    TEST_ASSERT_EQUAL(0, velocitySpeed(99, 0));
+    TEST_ASSERT_EQUAL(VELOCITY_MAX_SPEED, velocitySpeed(100, 0));
+    TEST_ASSERT_EQUAL(1, velocitySpeed(100, MAXZ));
+}
+
+struct FrameSink : CommandSink {
+    VISCACommand last;
+    void frame(uint8_t cam, const VISCACommand& command) override {
+        last = command;
+    }
+};
+void test_velocity_topic_uses_the_shadow_zoom() {
+    StaticJsonDocument<128> document;
+    FrameSink sink;
+    deserializeJson(document, "{\"x\":100,\"y\":-50,\"cam\":2}");
+    cams[2].setZ(0);
+    encodeCameraCommand(TOPIC_CAMERA_VELOCITY, document.as<JsonObject>(), sink);
+    const uint8_t wide[] = {0x83, 0x01, 0x06, 0x01, 0x1F, 0x0A, 0x02, 0x01,
+                            0xFF};
+    TEST_ASSERT_EQUAL(sizeof(wide), sink.last.len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(wide, sink.last.payload, sizeof(wide));
+
+    cams[2].setZ(MAXZ);
+    encodeCameraCommand(TOPIC_CAMERA_VELOCITY, document.as<JsonObject>(), sink);
+    // 0.3267 * 0.15 * 31 = 1.52
+    const uint8_t tele[] = {0x83, 0x01, 0x06, 0x01, 0x05, 0x02, 0x02, 0x01,
+                            0xFF};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(tele, sink.last.payload, sizeof(tele));
+}
+
+void setUp() { setVelocityConfig({5, 40, 15}); }
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_deadzone);
+    RUN_TEST(test_full_stick);
+    RUN_TEST(test_expo_curve);
+    RUN_TEST(test_zoom_steps);
+    RUN_TEST(test_falloff_toward_tele);
+    RUN_TEST(test_config);
+    RUN_TEST(test_velocity_topic_uses_the_shadow_zoom);
+    return UNITY_END();
+}
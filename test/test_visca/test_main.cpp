@@ -0,0 +1,352 @@
+// VISCA conformance: golden frames for every builder, framing and reply
+// parser properties, and how many frames per second the encoder, the parser
+// and the wire manage.
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <bus.h>
+#include <commands.h>
+#include <host_visca.h>
+#include <metrics.h>
+#include <trace.h>
+#include <unity.h>
+
+#include <chrono>
+
+static void assertFrame(const uint8_t* expected, size_t length,
+                        const VISCACommand& command) {
+    TEST_ASSERT_EQUAL(length, command.len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, command.payload, length);
+}
+#define ASSERT_FRAME(command, ...)                               \
+    do {                                                         \
+        const uint8_t expected[] = {__VA_ARGS__};                \
+        assertFrame(expected, sizeof(expected), (command));      \
+    } while (0)
+
+/*Golden frames*/
+// Written down from the command tables, not from what the builders send
+void test_blinkenlights() {
+    // 8x 01 33 0p 0q ff, LED p in mode q
+    ASSERT_FRAME(blinkenlights(1, 2, 0), 0x81, 0x01, 0x33, 0x01, 0x02, 0xFF);
+    ASSERT_FRAME(blinkenlights(0, 0, 6), 0x87, 0x01, 0x33, 0x00, 0x00, 0xFF);
+}
+void test_flip_mirror() {
+    // Picture flip 8x 01 04 66 02/03 ff, LR reverse 8x 01 04 61 02/03 ff
+    ASSERT_FRAME(flip(true, 0), 0x81, 0x01, 0x04, 0x66, 0x02, 0xFF);
+    ASSERT_FRAME(flip(false, 1), 0x82, 0x01, 0x04, 0x66, 0x03, 0xFF);
+    ASSERT_FRAME(mirror(true, 0), 0x81, 0x01, 0x04, 0x61, 0x02, 0xFF);
+    ASSERT_FRAME(mirror(false, 2), 0x83, 0x01, 0x04, 0x61, 0x03, 0xFF);
+}
+void test_backlight_mmdetect() {
+    // Backlight 8x 01 04 33 02/03 ff, motion detection 8x 01 50 30 01 0p ff
+    ASSERT_FRAME(backlight(true, 0), 0x81, 0x01, 0x04, 0x33, 0x02, 0xFF);
+    ASSERT_FRAME(backlight(false, 3), 0x84, 0x01, 0x04, 0x33, 0x03, 0xFF);
+    ASSERT_FRAME(mmdetect(true, 0), 0x81, 0x01, 0x50, 0x30, 0x01, 0x01, 0xFF);
+    ASSERT_FRAME(mmdetect(false, 0), 0x81, 0x01, 0x50, 0x30, 0x01, 0x00, 0xFF);
+}
+void test_wb() {
+    // Manual: 8x 01 04 35 06 ff, then the value 8x 01 04 75 0p 0q 0r 0s ff
+    ASSERT_FRAME(wb(0x1234, 0), 0x81, 0x01, 0x04, 0x35, 0x06, 0xFF,  //
+                 0x81, 0x01, 0x04, 0x75, 0x01, 0x02, 0x03, 0x04, 0xFF);
+    ASSERT_FRAME(wb(7, 2), 0x83, 0x01, 0x04, 0x35, 0x06, 0xFF,  //
+                 0x83, 0x01, 0x04, 0x75, 0x00, 0x00, 0x00, 0x07, 0xFF);
+    // -1 is auto, 8x 01 04 35 00 ff and nothing else
+    ASSERT_FRAME(wb(-1, 1), 0x82, 0x01, 0x04, 0x35, 0x00, 0xFF);
+}
+void test_iris() {
+    // Manual exposure: 8x 01 04 39 03 ff, then the iris 8x 01 04 4b 00 00 0p
+    // 0q ff
+    ASSERT_FRAME(iris(0x0A, 0), 0x81, 0x01, 0x04, 0x39, 0x03, 0xFF,  //
+                 0x81, 0x01, 0x04, 0x4B, 0x00, 0x00, 0x00, 0x0A, 0xFF);
+    ASSERT_FRAME(iris(0x11, 4), 0x85, 0x01, 0x04, 0x39, 0x03, 0xFF,  //
+                 0x85, 0x01, 0x04, 0x4B, 0x00, 0x00, 0x01, 0x01, 0xFF);
+    // -1 is full auto, 8x 01 04 39 00 ff and nothing else
+    ASSERT_FRAME(iris(-1, 0), 0x81, 0x01, 0x04, 0x39, 0x00, 0xFF);
+}
+void test_relative_movement() {
+    // Pan-tilt drive 8x 01 06 01 VV WW 0p 0q ff, stop first, then the move.
+    // Pan p: 01 left, 02 right, 03 stop. Tilt q: 01 up, 02 down, 03 stop.
+    // Speed scales 0..100 onto 0..0x1f.
+    ASSERT_FRAME(relativeMovement(50, -100, 0),  //
+                 0x81, 0x01, 0x06, 0x01, 0x00, 0x00, 0x03, 0x03, 0xFF,  //
+                 0x81, 0x01, 0x06, 0x01, 0x0F, 0x1F, 0x02, 0x01, 0xFF);
+    ASSERT_FRAME(relativeMovement(-100, 100, 1),  //
+                 0x82, 0x01, 0x06, 0x01, 0x00, 0x00, 0x03, 0x03, 0xFF,  //
+                 0x82, 0x01, 0x06, 0x01, 0x1F, 0x1F, 0x01, 0x02, 0xFF);
+    ASSERT_FRAME(relativeMovement(0, 0, 0),  //
+                 0x81, 0x01, 0x06, 0x01, 0x00, 0x00, 0x03, 0x03, 0xFF,  //
+                 0x81, 0x01, 0x06, 0x01, 0x00, 0x00, 0x03, 0x03, 0xFF);
+}
+void test_pan_tilt_drive() {
+    // 8x 01 06 01 VV WW 0p 0q ff on its own
+    ASSERT_FRAME(panTiltDrive(0x10, 0x08, 1, -1, 0),  //
+                 0x81, 0x01, 0x06, 0x01, 0x10, 0x08, 0x02, 0x01, 0xFF);
+    // Speed 0 stops that axis whatever the direction
+    ASSERT_FRAME(panTiltDrive(0, 0x08, 1, 1, 2),  //
+                 0x83, 0x01, 0x06, 0x01, 0x00, 0x08, 0x03, 0x02, 0xFF);
+}
+void test_movement() {
+    // Focus mode 8x 01 04 38 02/03 ff, stop, then the absolute position
+    // 8x 01 06 20 with x, y, z and focus as four nibbles each
+    ASSERT_FRAME(movement(0, PTZCam(0x123, 0x45, 0x678, 0x9AB)),  //
+                 0x81, 0x01, 0x04, 0x38, 0x03, 0xFF,                      //
+                 0x81, 0x01, 0x06, 0x01, 0x03, 0x03, 0x03, 0x03, 0xFF,  //
+                 0x81, 0x01, 0x06, 0x20,                                  //
+                 0x00, 0x01, 0x02, 0x03, 0x00, 0x00, 0x04, 0x05,          //
+                 0x00, 0x06, 0x07, 0x08, 0x00, 0x09, 0x0A, 0x0B, 0xFF);
+    // focus -1 is autofocus
+    VISCACommand command = movement(4, PTZCam(0, 0, 0, -1));
+    TEST_ASSERT_EQUAL_HEX8(0x85, command.payload[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x02, command.payload[4]);
+}
+void test_clear_buffer_set_address() {
+    // IF_Clear 8x 01 00 01 ff
+    ASSERT_FRAME(clearBuffer(0), 0x81, 0x01, 0x00, 0x01, 0xFF);
+    ASSERT_FRAME(clearBuffer(6), 0x87, 0x01, 0x00, 0x01, 0xFF);
+    // AddressSet 88 30 0p ff is a broadcast, whatever the camera
+    ASSERT_FRAME(setAddress(3, 1), 0x88, 0x30, 0x01, 0xFF);
+}
+void test_state_inquiry() {
+    // Pan-tilt position 8x 09 06 12 ff, zoom 8x 09 04 47 ff, focus
+    // 8x 09 04 48 ff, power 8x 09 04 00 ff
+    ASSERT_FRAME(stateInquiry(1),                   //
+                 0x82, 0x09, 0x06, 0x12, 0xFF,      //
+                 0x82, 0x09, 0x04, 0x47, 0xFF,      //
+                 0x82, 0x09, 0x04, 0x48, 0xFF);
+    ASSERT_FRAME(powerInquiry(2), 0x83, 0x09, 0x04, 0x00, 0xFF);
+}
+
+/*Framing properties*/
+void test_append_package_property() {
+    srand(28);
+    for (int round = 0; round < 500; round++) {
+        VISCACommand command;
+        command.len = 0;
+        for (int i = 0; i < 12; i++) {
+            uint8_t payload[40];
+            const uint8_t length = rand() % sizeof(payload);
+            for (uint8_t j = 0; j < length; j++) {
+                payload[j] = rand() % 0x80;
+            }
+            const uint8_t cam = rand() % NUM_CAMS;
+            const VISCACommand before = command;
+            appendPackage(command, payload, length, cam);
+
+            if (before.len + length + 2 > VISCACOMMAND_MAX_LENGTH) {
+                // Does not fit: nothing changes, not even partially
+                TEST_ASSERT_EQUAL(before.len, command.len);
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(before.payload, command.payload,
+                                             before.len);
+                continue;
+            }
+            TEST_ASSERT_EQUAL(before.len + length + 2, command.len);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(before.payload, command.payload,
+                                         before.len);
+            TEST_ASSERT_EQUAL_HEX8(0x80 + cameraAddress(cam),
+                                   command.payload[before.len]);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(payload,
+                                         command.payload + before.len + 1,
+                                         length);
+            TEST_ASSERT_EQUAL_HEX8(0xFF, command.payload[command.len - 1]);
+            TEST_ASSERT_LESS_OR_EQUAL(VISCACOMMAND_MAX_LENGTH, command.len);
+        }
+    }
+}
+
+/*Reply parser*/
+// The newest RX record in the flight recorder, i.e. what receive() last
+// handed to parseCommand()
+static TraceRecord lastReply() {
+    TraceRecord record = {};
+    TEST_ASSERT_TRUE(hostLastTrace(TRACE_RX, record));
+    return record;
+}
+
+static void feed(const uint8_t* data, size_t length) {
+    hostChain().hostInput(data, length);
+    serviceBuses();
+}
+static void assertDelivered(uint32_t repliesBefore, uint8_t cam,
+                            const uint8_t* frame, uint8_t length) {
+    TEST_ASSERT_EQUAL_UINT32(repliesBefore + 1, metrics.replies);
+    TraceRecord record = lastReply();
+    TEST_ASSERT_EQUAL(cam, record.cam);
+    TEST_ASSERT_EQUAL(length, record.len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(frame, record.data,
+                                 min(length, (uint8_t)TRACE_FRAME_BYTES));
+}
+
+void test_parser_every_address() {
+    for (uint8_t address = 1; address <= 7; address++) {
+        const uint8_t ack[] = {(uint8_t)(0x80 + (address << 4)), 0x41, 0xFF};
+        const uint32_t before = metrics.replies;
+        feed(ack, sizeof(ack));
+        assertDelivered(before, address - 1, ack, sizeof(ack));
+    }
+}
+void test_parser_ignores_non_headers() {
+    // 0x80 and 0x88 (broadcast) never start a reply, neither does noise
+    const uint8_t noise[] = {0x80, 0x41, 0xFF, 0x88, 0x30, 0x01, 0xFF,
+                             0x12, 0x7F, 0xFF, 0xFF};
+    const uint32_t before = metrics.replies;
+    feed(noise, sizeof(noise));
+    TEST_ASSERT_EQUAL_UINT32(before, metrics.replies);
+}
+void test_parser_resyncs_on_header() {
+    // The first reply lost its terminator, the next header starts over
+    const uint8_t stream[] = {0x90, 0x50, 0x02, 0x03, 0xA0, 0x51, 0xFF};
+    const uint32_t before = metrics.replies;
+    feed(stream, sizeof(stream));
+    assertDelivered(before, 1, stream + 4, 3);
+}
+void test_parser_split_reads() {
+    // Bytes trickle in over several loop() passes
+    const uint8_t reply[] = {0x90, 0x50, 0x00, 0x00, 0x01, 0x02, 0xFF};
+    const uint32_t before = metrics.replies;
+    for (uint8_t i = 0; i < sizeof(reply); i++) {
+        feed(reply + i, 1);
+    }
+    assertDelivered(before, 0, reply, sizeof(reply));
+}
+void test_parser_overlong_frames() {
+    uint8_t frame[VISCA_REPLY_MAX_LENGTH + 1];
+    frame[0] = 0x90;
+    for (uint8_t i = 1; i < sizeof(frame); i++) {
+        frame[i] = 0x01;
+    }
+    // Exactly the longest reply still goes through
+    frame[VISCA_REPLY_MAX_LENGTH - 1] = 0xFF;
+    uint32_t before = metrics.replies;
+    feed(frame, VISCA_REPLY_MAX_LENGTH);
+    assertDelivered(before, 0, frame, VISCA_REPLY_MAX_LENGTH);
+
+    // One byte more is dropped, including its late terminator
+    frame[VISCA_REPLY_MAX_LENGTH - 1] = 0x01;
+    frame[VISCA_REPLY_MAX_LENGTH] = 0xFF;
+    before = metrics.replies;
+    feed(frame, sizeof(frame));
+    TEST_ASSERT_EQUAL_UINT32(before, metrics.replies);
+
+    // And the parser is back in sync right after
+    const uint8_t ack[] = {0xB0, 0x42, 0xFF};
+    feed(ack, sizeof(ack));
+    assertDelivered(before, 2, ack, sizeof(ack));
+}
+void test_parser_fuzz() {
+    // Whatever garbage came before, a complete reply is delivered intact,
+    // and nothing delivered is ever longer than a reply or starts without a
+    // header.
+    srand(36);
+    for (int round = 0; round < 2000; round++) {
+        uint8_t garbage[40];
+        const uint8_t garbageLength = rand() % sizeof(garbage);
+        for (uint8_t i = 0; i < garbageLength; i++) {
+            garbage[i] = rand() % 0x100;
+        }
+        uint32_t before = metrics.replies;
+        feed(garbage, garbageLength);
+        const uint32_t delivered = metrics.replies - before;
+        if (delivered > 0) {
+            TraceRecord record = lastReply();
+            TEST_ASSERT_LESS_OR_EQUAL(VISCA_REPLY_MAX_LENGTH, record.len);
+            TEST_ASSERT_EQUAL_HEX8(0x80, record.data[0] & 0x8F);
+            TEST_ASSERT_GREATER_OR_EQUAL(0x90, record.data[0]);
+            TEST_ASSERT_LESS_THAN(NUM_CAMS, record.cam);
+        }
+
+        uint8_t reply[VISCA_REPLY_MAX_LENGTH];
+        const uint8_t address = 1 + rand() % 7;
+        const uint8_t length = 3 + rand() % (VISCA_REPLY_MAX_LENGTH - 2);
+        reply[0] = 0x80 + (address << 4);
+        for (uint8_t i = 1; i < length - 1; i++) {
+            reply[i] = rand() % 0x80;
+        }
+        reply[length - 1] = 0xFF;
+        before = metrics.replies;
+        feed(reply, length);
+        assertDelivered(before, address - 1, reply, length);
+    }
+}
+
+/*Throughput*/
+struct CountingSink : CommandSink {
+    uint32_t frames = 0;
+    uint32_t bytes = 0;
+    void frame(uint8_t cam, const VISCACommand& command) override {
+        frames++;
+        bytes += command.len;
+    }
+};
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+void test_benchmark_frames_per_second() {
+    StaticJsonDocument<256> document;
+    deserializeJson(document, "{\"cam\":2,\"x\":400,\"y\":100,\"z\":900}");
+    CountingSink sink;
+    const uint32_t rounds = 20000;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < rounds; i++) {
+        encodeCameraCommand(TOPIC_CAMERA_MOVETO, document.as<JsonObject>(),
+                            sink);
+    }
+    const double encoded = sink.frames / secondsSince(start);
+
+    const uint8_t reply[] = {0x90, 0x50, 0x00, 0x00, 0x01, 0x02, 0xFF};
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < rounds; i++) {
+        feed(reply, sizeof(reply));
+    }
+    const double parsed = rounds / secondsSince(start);
+
+    // The wire is what really limits it: 10 bits per byte at 9600 baud
+    const uint32_t wireStart = micros();
+    const VISCACommand command = relativeMovement(30, 0, 0);
+    for (uint8_t i = 0; i < 10; i++) {
+        busWriteRaw(0, command.payload, command.len);
+    }
+    const double wire = 10 * 1e6 / (micros() - wireStart);
+    TEST_ASSERT_UINT32_WITHIN(10, 10 * command.len * HOST_BAUD_BYTE_US,
+                              micros() - wireStart);
+
+    char message[128];
+    snprintf(message, sizeof(message),
+             "encode %.0f frames/s, parse %.0f replies/s, wire %.1f moveby/s",
+             encoded, parsed, wire);
+    TEST_MESSAGE(message);
+    // Far below any host, only catches something going badly wrong
+    TEST_ASSERT_GREATER_THAN(10000, (uint32_t)encoded);
+    TEST_ASSERT_GREATER_THAN(10000, (uint32_t)parsed);
+}
+
+void setUp() {
+    buses[0].receiving = false;
+    hostChain().hostClear();
+}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    beginBuses();
+    UNITY_BEGIN();
+    RUN_TEST(test_blinkenlights);
+    RUN_TEST(test_flip_mirror);
+    RUN_TEST(test_backlight_mmdetect);
+    RUN_TEST(test_wb);
+    RUN_TEST(test_iris);
+    RUN_TEST(test_relative_movement);
+    RUN_TEST(test_pan_tilt_drive);
+    RUN_TEST(test_movement);
+    RUN_TEST(test_clear_buffer_set_address);
+    RUN_TEST(test_state_inquiry);
+    RUN_TEST(test_append_package_property);
+    RUN_TEST(test_parser_every_address);
+    RUN_TEST(test_parser_ignores_non_headers);
+    RUN_TEST(test_parser_resyncs_on_header);
+    RUN_TEST(test_parser_split_reads);
+    RUN_TEST(test_parser_overlong_frames);
+    RUN_TEST(test_parser_fuzz);
+    RUN_TEST(test_benchmark_frames_per_second);
+    return UNITY_END();
+}
@@ -0,0 +1,165 @@
+// A local WebSocket control panel against the whole bridge: commands, answers
+// coming back over the socket instead of the broker, the admin topics being
+// refused, and a client that stopped reading not holding up loop().
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <WebSocketsServer.h>
+#include <bus.h>
+#include <host_visca.h>
+#include <metrics.h>
+#include <unity.h>
+#include <websocket.h>
+
+extern PubSubClient client;
+void setup();
+void loop();
+
+static WebSocketsServer& server() { return *hostWebSocketServer; }
+static const char* lastText(uint8_t num) {
+    const WebSocketsServer::Message* message = server().hostLast(num);
+    return message ? message->data : "";
+}
+static bool startsWith(const char* text, const char* prefix) {
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
+// Runs loop() until the client has no state pushes left
+static void settle() {
+    for (uint8_t i = 0; i < 2 * NUM_CAMS; i++) {
+        loop();
+        hostAdvanceMs(WEBSOCKET_PUSH_INTERVAL_MS);
+    }
+}
+
+void test_connect_pushes_every_camera() {
+    const uint32_t before = server().hostSent();
+    server().hostConnect(0);
+    settle();
+    TEST_ASSERT_EQUAL_UINT32(before + NUM_CAMS, server().hostSent());
+    TEST_ASSERT_TRUE(startsWith(lastText(0), "{\"cam\":"));
+}
+void test_commands_reach_the_bus() {
+    hostChain().hostClear();
+    server().hostText(0, "command/camera/moveby {\"x\":20,\"cam\":1}");
+    loop();
+    TEST_ASSERT_EQUAL(1, hostChain().hostWrites());
+    TEST_ASSERT_EQUAL_HEX8(0x82, hostChain().hostBytes()[0]);
+    settle();
+}
+void test_answers_go_back_over_the_socket() {
+    const uint32_t publishes = client.hostPublishes();
+    server().hostText(0, "command/system/time {}");
+    TEST_ASSERT_TRUE(startsWith(lastText(0), "return/system/time {\"time\":"));
+    server().hostText(0, "command/system/metrics {}");
+    TEST_ASSERT_TRUE(startsWith(lastText(0), "return/system/metrics {"));
+    server().hostText(0, "command/camera/errors {\"cam\":2}");
+    TEST_ASSERT_TRUE(
+        startsWith(lastText(0), "return/camera/errors {\"cam\":2,"));
+    // Binary messages are answered the same way
+    const uint8_t time[] = {TOPIC_SYSTEM_TIME, '{', '}'};
+    server().hostBinary(0, time, sizeof(time));
+    TEST_ASSERT_TRUE(startsWith(lastText(0), "return/system/time "));
+    TEST_ASSERT_EQUAL_UINT32(publishes, client.hostPublishes());
+}
+void test_state_answers_follow_each_requester() {
+    server().hostConnect(1);
+    settle();
+    const uint32_t publishes = client.hostPublishes();
+    client.hostDeliver("VISCA/command/camera/getState",
+                       "{\"cam\":0,\"maxAge\":0,\"id\":1}");
+    server().hostText(0, "command/camera/getState {\"cam\":0,\"maxAge\":0,"
+                         "\"id\":2}");
+    server().hostText(1, "command/camera/getState {\"cam\":0,\"maxAge\":0,"
+                         "\"id\":3}");
+    server().hostText(0, "command/camera/getState {\"cam\":0,\"maxAge\":0,"
+                         "\"id\":4}");
+    loop();
+    const uint8_t panTilt[] = {0x90, 0x50, 0x00, 0x01, 0x09, 0x00,
+                               0x00, 0x00, 0x06, 0x0A, 0xFF};
+    const uint8_t zoom[] = {0x90, 0x50, 0x00, 0x05, 0x0A, 0x02, 0xFF};
+    const uint8_t focus[] = {0x90, 0x50, 0x00, 0x09, 0x0C, 0x04, 0xFF};
+    hostChain().hostInput(panTilt, sizeof(panTilt));
+    hostChain().hostInput(zoom, sizeof(zoom));
+    hostChain().hostInput(focus, sizeof(focus));
+    loop();
+
+    // One inquiry, one answer per transport with the ids asked there
+    const PubSubClient::Message* mqtt = client.hostLast("return/camera/state");
+    TEST_ASSERT_NOT_NULL(mqtt);
+    TEST_ASSERT_TRUE(startsWith((const char*)mqtt->payload,
+                                "{\"cam\":0,\"ids\":[1],\"x\":400,"));
+    TEST_ASSERT_EQUAL_UINT32(publishes + 1, client.hostPublishes());
+    TEST_ASSERT_TRUE(startsWith(
+        lastText(0), "return/camera/state {\"cam\":0,\"ids\":[2,4],"));
+    TEST_ASSERT_TRUE(startsWith(
+        lastText(1), "return/camera/state {\"cam\":0,\"ids\":[3],"));
+    server().hostDisconnect(1);
+}
+void test_admin_topics_are_refused() {
+    const char* refused[] = {
+        "command/system/reboot {}",
+        "command/system/resetConfig {\"reset\":true}",
+        "command/system/updateConfig {\"mqtt_server\":\"evil\"}",
+        "command/system/getConfig {}",
+    };
+    for (const char* text : refused) {
+        server().hostText(0, text);
+        TEST_ASSERT_EQUAL_STRING(
+            "not allowed over WebSocket, use MQTT or the console",
+            lastText(0));
+    }
+    const uint8_t reboot[] = {TOPIC_SYSTEM_REBOOT, '{', '}'};
+    server().hostBinary(0, reboot, sizeof(reboot));
+    TEST_ASSERT_FALSE(hostRestarted);
+
+    // Still there for the broker
+    client.hostDeliver("VISCA/command/system/reboot", "{}");
+    TEST_ASSERT_TRUE(hostRestarted);
+    hostRestarted = false;
+}
+void test_stalled_client_does_not_block() {
+    server().hostConnect(2);
+    settle();
+    // Client 2 stopped reading, its TCP send buffer is full
+    server().hostTcp[2].hostWriteSpace = 0;
+    const uint32_t backpressure = metrics.webSocketBackpressure;
+    const uint32_t pushes = metrics.webSocketPushes;
+
+    const unsigned long start = millis();
+    server().hostText(2, "command/system/metrics {}");
+    server().hostText(0, "command/camera/moveto {\"x\":20,\"cam\":3}");
+    loop();
+    hostAdvanceMs(WEBSOCKET_PUSH_INTERVAL_MS);
+    loop();
+    TEST_ASSERT_LESS_THAN(100, millis() - start);
+    TEST_ASSERT_GREATER_THAN_UINT32(backpressure,
+                                    metrics.webSocketBackpressure);
+    // Client 0 got camera 3's new state, client 2 still owes it
+    TEST_ASSERT_GREATER_THAN_UINT32(pushes, metrics.webSocketPushes);
+    TEST_ASSERT_TRUE(startsWith(lastText(0), "{\"cam\":3,"));
+    TEST_ASSERT_FALSE(startsWith(lastText(2), "{\"cam\":3,"));
+
+    // Once it reads again it catches up
+    server().hostTcp[2].hostWriteSpace = 2920;
+    settle();
+    TEST_ASSERT_TRUE(startsWith(lastText(2), "{\"cam\":3,"));
+    server().hostDisconnect(2);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main(int argc, char** argv) {
+    WiFi.hostStatus = WL_CONNECTED;
+    setup();
+    for (uint8_t i = 0; i < 10 && !client.connected(); i++) {
+        loop();
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_connect_pushes_every_camera);
+    RUN_TEST(test_commands_reach_the_bus);
+    RUN_TEST(test_answers_go_back_over_the_socket);
+    RUN_TEST(test_state_answers_follow_each_requester);
+    RUN_TEST(test_admin_topics_are_refused);
+    RUN_TEST(test_stalled_client_does_not_block);
+    return UNITY_END();
+}
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Turns a flight recorder dump from VISCA/return/system/trace into a timeline.
+
+    mosquitto_sub -h <broker> -t VISCA/return/system/trace -C 1 > trace.bin &
+    mosquitto_pub -h <broker> -t VISCA/command/system/trace -m '{}'
+    python3 tools/trace_decode.py trace.bin
+"""
+import struct
+import sys
+
+# Same order as TopicId in src/topics.h
+TOPICS = [
+    "-",
+    "camera/raw",
+    "camera/blinkenlights",
+    "camera/settings",
+    "camera/picture",
+    "camera/moveto",
+    "camera/moveby",
+    "camera/clearBuffer",
+    "camera/setAddress",
+    "system/resetConfig",
+    "system/updateConfig",
+    "system/getConfig",
+    "system/time",
+    "system/reboot",
+    "system/trace",
+    "system/metrics",
+    "camera/velocity",
+    "camera/velocityConfig",
+    "camera/getState",
+    "camera/errors",
+    "system/macro/define",
+    "system/macro/run",
+    "system/macro/stop",
+    "system/macro/delete",
+    "camera/raw/1",
+    "camera/raw/2",
+]
+KINDS = ["TX", "RX", "MQTT", "WS", "USB"]
+OUTCOMES = ["ok", "scheduled", "dropped", "unknown topic", "bad json"]
+
+HEADER = struct.Struct("<4sBBHII")
+RECORD_FIXED = struct.Struct("<IBBBBB")
+
+
+def name(table, index):
+    return table[index] if index < len(table) else str(index)
+
+
+def decode(blob):
+    magic, version, record_size, count, now, written = HEADER.unpack_from(blob)
+    if magic != b"VTRC":
+        raise ValueError("not a trace dump")
+    if version != 1:
+        raise ValueError("unsupported trace version %d" % version)
+
+    print("dumped at %d ms, %d records since boot, showing %d"
+          % (now, written, count))
+    offset = HEADER.size
+    for _ in range(count):
+        record = blob[offset:offset + record_size]
+        offset += record_size
+        time, kind, cam, topic, outcome, length = RECORD_FIXED.unpack_from(record)
+        data = record[RECORD_FIXED.size:RECORD_FIXED.size + length]
+        if kind >= 2:
+            shown = data.decode("utf-8", "replace")
+        else:
+            shown = " ".join("%02x" % b for b in data)
+        if length > len(data):
+            shown += " ... (%d bytes)" % length
+        print("%10d %+8d  %-4s cam %-3d %-22s %-13s %s" % (
+            time, time - now, name(KINDS, kind), cam, name(TOPICS, topic),
+            name(OUTCOMES, outcome), shown))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit("usage: trace_decode.py <dump.bin>")
+    with open(sys.argv[1], "rb") as f:
+        decode(f.read())